@@ -0,0 +1,160 @@
+#include <string.h>
+#include "flashring.h"
+#include "flashring7.h"
+#include "cartlib.h"
+
+// the ring, once the ARM9 has sent it, and how far we have got in it
+static FlashRing* ring = NULL;
+static u32 erasesDone = 0;
+static u32 programsDone = 0;
+static int erasing = 0;
+static int failed = 0;
+
+// what the ARM9 hasn't been told yet
+static u32 erasesReported = 0;
+static u32 programsReported = 0;
+static u32 failure = 0;
+
+static void Fail(u32 message, u32 address)
+{
+	failed = 1;
+	if(failure == 0)
+	{
+		failure = message | ((address - ADDRESS(CART_BASE)) & FLASHRING_MSG_VALUE);
+	}
+}
+
+// The FIFO only has room for 16 words, so the counts are sent when there
+// is room, and a failure before the counts that include it.
+static void Report(void)
+{
+	if(failure != 0)
+	{
+		if(!FlashRingSend(failure))
+		{
+			return;
+		}
+		failure = 0;
+	}
+	if(erasesReported != erasesDone &&
+		FlashRingSend(FLASHRING_MSG_ERASED | (erasesDone & FLASHRING_MSG_VALUE)))
+	{
+		erasesReported = erasesDone;
+	}
+	if(programsReported != programsDone &&
+		FlashRingSend(FLASHRING_MSG_PROGRAMMED | (programsDone & FLASHRING_MSG_VALUE)))
+	{
+		programsReported = programsDone;
+	}
+}
+
+// Returns non-zero if none of the blocks the program is in is still
+// queued to be erased.
+static int IsErased(const FlashRingProgram* program, u32 eraseHead)
+{
+	u32 i;
+	for(i = erasesDone; i != eraseHead; i++)
+	{
+		u32 block = ring->erases[i % FLASHRING_ERASES];
+		if(block + 0x40000 > program->address &&
+			block < program->address + program->length)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void Program(const FlashRingProgram* program)
+{
+	if(failed)
+	{
+		// the rest of the file is no use
+		return;
+	}
+
+	u8* data = ring->data + program->position % FLASHRING_DATA_SIZE;
+	int suspended = erasing && SuspendTurboFAErase();
+	int written = WriteTurboFACart(ADDRESS(data), program->address, program->length / 64);
+	int verified = written &&
+		(!program->verify || memcmp(data, (void*)program->address, program->length) == 0);
+	if(suspended)
+	{
+		ResumeTurboFAErase();
+	}
+
+	if(!written)
+	{
+		Fail(FLASHRING_MSG_WRITE_FAILED, program->address);
+	}
+	else if(!verified)
+	{
+		Fail(FLASHRING_MSG_VERIFY_FAILED, program->address);
+	}
+}
+
+int FlashRingStep(void)
+{
+	u32 message;
+	if(FlashRingReceive(&message))
+	{
+		ring = (FlashRing*)message;
+	}
+	if(ring == NULL)
+	{
+		return 0;
+	}
+
+	// a program is queued after the erases it needs
+	u32 programHead = ring->programHead;
+	u32 eraseHead = ring->eraseHead;
+	int busy = 0;
+
+	if(erasing)
+	{
+		u32 result = PollTurboFAErase();
+		if(result != 0)
+		{
+			if(result != 1)
+			{
+				Fail(FLASHRING_MSG_ERASE_FAILED, ring->erases[erasesDone % FLASHRING_ERASES]);
+			}
+			erasing = 0;
+			erasesDone++;
+			busy = 1;
+		}
+	}
+
+	if(!erasing && erasesDone != eraseHead)
+	{
+		u32 block = ring->erases[erasesDone % FLASHRING_ERASES];
+		erasing = StartTurboFAErase(block);
+		if(!erasing)
+		{
+			Fail(FLASHRING_MSG_ERASE_FAILED, block);
+			erasesDone++;
+		}
+		busy = 1;
+	}
+
+	if(programsDone != programHead)
+	{
+		const FlashRingProgram* program = &ring->programs[programsDone % FLASHRING_PROGRAMS];
+		if(IsErased(program, eraseHead))
+		{
+			Program(program);
+			programsDone++;
+			busy = 1;
+		}
+	}
+
+	if(erasesDone == eraseHead && programsDone == programHead)
+	{
+		// whatever comes next is another file
+		failed = 0;
+	}
+
+	Report();
+	// keeps polling while erasing, to start programming as soon as it can
+	return busy || erasing || programsDone != programHead;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Carries out what the ARM9 has queued in the flash ring, see flashring.h.
+// Returns non-zero while there is anything left to do.
+int FlashRingStep(void);
@@ -7,6 +7,7 @@
 #include <dswifi7.h>
 
 #include "boot7.h"
+#include "flashring7.h"
 
 // stuff below from libnds default arm7
 
@@ -33,6 +34,7 @@ s32 getFreeSoundChannel() {
 
 int vcount;
 touchPosition first,tempPos;
+vu32 frames;
 
 //---------------------------------------------------------------------------------
 void VcountHandler() {
@@ -96,6 +98,7 @@ void VblankHandler(void) {
 
 	u32 i;
 
+	frames++;
 
 	//sound code  :)
 	TransferSound *snd = IPC->soundData;
@@ -176,10 +179,20 @@ int main(int argc, char ** argv)
 
 	SetupWifi();
 
-	// keep the ARM7 out of main RAM
+	// keep the ARM7 out of main RAM, unless the ARM9 has it programming
+	// the flash cart, see flashring.h
+	u32 lastFrame = frames;
 	while(true)
 	{
-		swiWaitForVBlank();
+		if(!FlashRingStep())
+		{
+			swiWaitForVBlank();
+		}
+		if(frames == lastFrame)
+		{
+			continue;
+		}
+		lastFrame = frames;
 		Wifi_Update();
 
 		if (IPC->mailData == 1)
@@ -0,0 +1,36 @@
+#include <stdlib.h>
+#include <new>
+#include "allocation.h"
+
+static unsigned int allocationCount = 0;
+
+unsigned int GetAllocationCount()
+{
+	return allocationCount;
+}
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+	allocationCount++;
+	void* p = malloc(size);
+	if(p == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	free(p);
+}
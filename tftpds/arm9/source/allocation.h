@@ -0,0 +1,5 @@
+#pragma once
+
+// Counts the allocations made with new, so that code that must not allocate
+// can check that it doesn't.
+unsigned int GetAllocationCount();
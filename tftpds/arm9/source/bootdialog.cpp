@@ -42,65 +42,19 @@ BootDialog::~BootDialog()
 	}
 }
 
-
-static const unsigned char nintendo_logo[] =
-{
-	0x24,0xFF,0xAE,0x51,0x69,0x9A,0xA2,0x21,0x3D,0x84,0x82,0x0A,0x84,0xE4,0x09,0xAD,
-	0x11,0x24,0x8B,0x98,0xC0,0x81,0x7F,0x21,0xA3,0x52,0xBE,0x19,0x93,0x09,0xCE,0x20,
-	0x10,0x46,0x4A,0x4A,0xF8,0x27,0x31,0xEC,0x58,0xC7,0xE8,0x33,0x82,0xE3,0xCE,0xBF,
-	0x85,0xF4,0xDF,0x94,0xCE,0x4B,0x09,0xC1,0x94,0x56,0x8A,0xC0,0x13,0x72,0xA7,0xFC,
-	0x9F,0x84,0x4D,0x73,0xA3,0xCA,0x9A,0x61,0x58,0x97,0xA3,0x27,0xFC,0x03,0x98,0x76,
-	0x23,0x1D,0xC7,0x61,0x03,0x04,0xAE,0x56,0xBF,0x38,0x84,0x00,0x40,0xA7,0x0E,0xFD,
-	0xFF,0x52,0xFE,0x03,0x6F,0x95,0x30,0xF1,0x97,0xFB,0xC0,0x85,0x60,0xD6,0x80,0x25,
-	0xA9,0x63,0xBE,0x03,0x01,0x4E,0x38,0xE2,0xF9,0xA2,0x34,0xFF,0xBB,0x3E,0x03,0x44,
-	0x78,0x00,0x90,0xCB,0x88,0x11,0x3A,0x94,0x65,0xC0,0x7C,0x63,0x87,0xF0,0x3C,0xAF,
-	0xD6,0x25,0xE4,0x8B,0x38,0x0A,0xAC,0x72,0x21,0xD4,0xF8,0x07,
-};
-
+// from the catalog, or by looking at every block of the cart if there isn't
+// one
 void BootDialog::ScanItems()
 {
-	char* ptr = (char*)0x8000000;
-	int i = 0;
-	while(i < MAX_ITEMS && ptr < (char*)0xA000000)
-	{
-		bool pass = (memcmp("PASS", ptr+0xAC, 4) == 0);
-		bool gbalogo = (memcmp(nintendo_logo, ptr+0x4, sizeof(nintendo_logo)) == 0);
-		bool loader = (memcmp("NDS loader for GBA flashcards", ptr+0x21, 29) == 0);
+	CatalogEntry entries[MAX_ITEMS];
+	numItems = Catalog::List(entries, MAX_ITEMS);
 
-		if(loader || (pass && gbalogo))
-		{
-			items[i].filetype = FILETYPE_DS_GBA;
-			strncpy(items[i].title, ptr+0xA0, 12);
-		}
-		else if(pass)
-		{
-			items[i].filetype = FILETYPE_NDS;
-			strcpy(items[i].title, "unknown");
-		}
-		else if(gbalogo)
-		{
-			items[i].filetype = FILETYPE_GBA;
-			strncpy(items[i].title, ptr+0xA0, 12);
-		}
-		else
-		{
-			items[i].filetype = FILETYPE_NONE;
-		}
-
-		if(items[i].filetype != FILETYPE_NONE)
-		{
-			items[i].address = ptr - 0x8000000;
-			i++;
-		}
-
-		ptr += 0x40000;
-	}
-
-	numItems = i;
-
-	for(; i < MAX_ITEMS; i++)
+	memset(items, 0, sizeof(items));
+	for(int i = 0; i < numItems; i++)
 	{
-		memset(items + i, 0, sizeof(BootItem));
+		items[i].filetype = (Filetype)entries[i].filetype;
+		strncpy(items[i].title, entries[i].title, CATALOG_TITLE_LENGTH);
+		items[i].address = (char*)entries[i].offset;
 	}
 }
 
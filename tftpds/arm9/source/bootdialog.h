@@ -4,18 +4,11 @@
 #include <label.h>
 #include <button.h>
 #include <imagebutton.h>
+#include "catalog.h"
 
 #define NUM_BUTTONS 6
 #define MAX_ITEMS 32
 
-enum Filetype
-{
-	FILETYPE_NONE = 0,
-	FILETYPE_GBA,
-	FILETYPE_NDS,
-	FILETYPE_DS_GBA
-};
-
 struct BootItem
 {
 	Filetype filetype;
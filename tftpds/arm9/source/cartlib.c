@@ -1,5 +1,10 @@
 #include <stdio.h>
-#include <nds.h>
+#include "platform.h"
+
+#ifdef ARM7
+// the ARM7 has no console to print to
+#define printf(...)
+#endif
 
 // *** GBA flash cart support routines in GCC ***
 //  This library allows programming FA/Visoly (both Turbo
@@ -132,6 +137,7 @@ void WriteRepeat (int addr, int data, int count)
  #define INTEL28F_READSR     0x70
  #define INTEL28F_RIC        0x90
  #define INTEL28F_WRTOBUF    0xe8
+ #define INTEL28F_SUSPEND    0xb0
 
  #define SHARP28F_BLOCKERASE 0x20
  #define SHARP28F_CONFIRM    0xD0
@@ -150,6 +156,23 @@ void WriteRepeat (int addr, int data, int count)
  #define _CART_START 0x8000000
  #define _BACKUP_START 0xe000000
  #define FLINKER_SET         {}
+ #ifdef HOST
+ // Host defines: the cart is emulated by host/hostflash.c, which has to
+ // see every access to it, so they all go through WriteFlash and ReadFlash
+ void WriteFlash (u32 addr, u16 data);
+ u16 ReadFlash (u32 addr);
+ #define READ_NTURBO_SR(a,b) WriteFlash (a, INTEL28F_READSR);    \
+                             b = ReadFlash (a)
+ #define READ_NTURBO_S(a)    a = ReadFlash (_CART_START)
+ #define READ_TURBO_SR(a)    WriteFlash (_CART_START, INTEL28F_READSR);   \
+                             WriteFlash (_CART_START+2, INTEL28F_READSR); \
+                             a = ReadFlash (_CART_START) & 0xff;          \
+                             a += (ReadFlash (_CART_START+2) & 0xff) << 8
+ #define READ_TURBO_S(a)     a = ReadFlash (_CART_START) & 0xff;          \
+                             a += (ReadFlash (_CART_START+2) & 0xff) << 8
+ #define READ_TURBO_S2(a,b,c) b = ReadFlash (a) & 0x80;           \
+                              c = ReadFlash (a+2) & 0x80
+ #else
  #define READ_NTURBO_SR(a,b) *(vu16 *)a = INTEL28F_READSR;     \
                              b = *(vu16 *)a
  #define READ_NTURBO_S(a)    a = *(vu16 *)_CART_START
@@ -161,6 +184,7 @@ void WriteRepeat (int addr, int data, int count)
                              a += (*(vu16 *)(_CART_START+2) & 0xff) << 8
  #define READ_TURBO_S2(a,b,c) b = *(vu16 *)a & 0x80;            \
                               c = *(vu16 *)(a+2) & 0x80
+ #endif
  #define WRITE_FLASH_NEXT(a,b) WriteFlash (a, b)
  #define SET_CART_ADDR(a)    {}
  #define CTRL_PORT_0         {}
@@ -182,16 +206,22 @@ void WriteRepeat (int addr, int data, int count)
  u32 WriteNintendoFlashCart (u32 SrcAddr, u32 FlashAddr, u32 Length) CL_SECTION;
  u32 WriteNonTurboFACart (u32 SrcAddr, u32 FlashAddr, u32 Length) CL_SECTION;
  u32 WriteTurboFACart (u32 SrcAddr, u32 FlashAddr, u32 Length) CL_SECTION;
+ u32 StartTurboFAErase (u32 BlockAddr) CL_SECTION;
+ u32 PollTurboFAErase (void) CL_SECTION;
+ u32 SuspendTurboFAErase (void) CL_SECTION;
+ void ResumeTurboFAErase (void) CL_SECTION;
   #endif
 
+ #ifndef HOST
 void WriteFlash (u32 addr, u16 data) { *(vu16 *)addr = data; }
 u16 ReadFlash (u32 addr) { return(*(vu16 *)addr); }
+ #endif
 
 void WriteRepeat (u32 addr, u16 data, u16 count)
    {
    u16 i;
    for (i=0; i<count; i++)
-      *(vu16 *)(_CART_START + (addr << 1)) = data;
+      WriteFlash (_CART_START + (addr << 1), data);
    }
 #endif
 
@@ -487,6 +517,112 @@ u32 EraseTurboFABlocks (u32 StartAddr, u32 BlockCount)
 
    return (Ready != 0);
    }
+
+// Start erasing the block at BlockAddr in both flash chips, without
+// waiting for it to finish. Poll with PollTurboFAErase, and don't read
+// the cart until it's done.
+// Function returns true if the erase was started.
+
+u32 StartTurboFAErase (u32 BlockAddr)
+   {
+   u16 j;
+   u16 done1,done2;
+   u16 Ready = 0;
+   u32 Timeout = FP_TIMEOUT2;
+
+   while ((!Ready) && (Timeout != 0))
+      {
+      READ_TURBO_SR(j);
+      Ready = (j == 0x8080);
+      Timeout--;
+      }
+   if (!Ready)
+      return (0);
+
+   done1 = 0;
+   done2 = 0;
+   Ready = 0;
+   Timeout = FP_TIMEOUT3;
+
+   while ((!Ready) && (Timeout != 0))
+      {
+      if (done1 == 0) WriteFlash (BlockAddr, INTEL28F_BLOCKERASE);
+      if (done2 == 0) WriteFlash (BlockAddr+_MEM_INC, INTEL28F_BLOCKERASE);
+
+      READ_TURBO_S2(_CART_START,done1,done2);
+      Ready = ((done1+done2) == 0x100);
+
+      Timeout--;
+      }
+   if (!Ready)
+      {
+      WriteFlash (BlockAddr, INTEL28F_CLEARSR);
+      WriteFlash (BlockAddr+_MEM_INC, INTEL28F_CLEARSR);
+      WriteFlash (_CART_START, INTEL28F_READARRAY);
+      WriteFlash (_CART_START+_MEM_INC, INTEL28F_READARRAY);
+      return (0);
+      }
+
+   WriteFlash (BlockAddr, INTEL28F_CONFIRM);
+   WriteFlash (BlockAddr+_MEM_INC, INTEL28F_CONFIRM);
+   return (1);
+   }
+
+// Check on an erase started by StartTurboFAErase.
+// Function returns 0 while erasing, 1 when done and 2 if it failed.
+
+u32 PollTurboFAErase (void)
+   {
+   u16 j;
+   u32 Result;
+
+   READ_TURBO_SR(j);
+   if ((j & 0x8080) != 0x8080)
+      return (0);
+
+   // erase, program and vpp errors
+   Result = 1;
+   if (j & 0x3a3a)
+      {
+      WriteFlash (_CART_START, INTEL28F_CLEARSR);
+      WriteFlash (_CART_START+_MEM_INC, INTEL28F_CLEARSR);
+      Result = 2;
+      }
+
+   WriteFlash (_CART_START, INTEL28F_READARRAY);
+   WriteFlash (_CART_START+_MEM_INC, INTEL28F_READARRAY);
+   return (Result);
+   }
+
+// Suspend an erase started by StartTurboFAErase, so that other blocks can
+// be read and written until ResumeTurboFAErase.
+// Function returns false if there was nothing to suspend, because the
+// erase had finished.
+
+u32 SuspendTurboFAErase (void)
+   {
+   u16 j = 0;
+   u32 Timeout = FP_TIMEOUT2;
+
+   WriteFlash (_CART_START, INTEL28F_SUSPEND);
+   WriteFlash (_CART_START+_MEM_INC, INTEL28F_SUSPEND);
+
+   while (((j & 0x8080) != 0x8080) && (Timeout != 0))
+      {
+      READ_TURBO_SR(j);
+      Timeout--;
+      }
+
+   WriteFlash (_CART_START, INTEL28F_READARRAY);
+   WriteFlash (_CART_START+_MEM_INC, INTEL28F_READARRAY);
+   return ((j & 0x4040) != 0);
+   }
+
+void ResumeTurboFAErase (void)
+   {
+   WriteFlash (_CART_START, INTEL28F_CONFIRM);
+   WriteFlash (_CART_START+_MEM_INC, INTEL28F_CONFIRM);
+   }
 #endif
 
 #ifdef NOA_FLASH_CART_SUPPORT
@@ -601,12 +737,53 @@ u32 WriteNonTurboFACart (u32 SrcAddr, u32 FlashAddr, u32 Length)
 #endif
 
 #ifdef TURBO_FA_SUPPORT
+// Returns true if the 64 bytes at SrcAddr are all 0xff, which is what an
+// erased block already reads as, so they don't have to be programmed.
+static int IsBlankTurboFABuffer (u32 SrcAddr)
+   {
+   int i;
+   for (i=0; i<64; i+=2)
+      if (*(u16 *)(SrcAddr+i) != 0xffff)
+         return 0;
+   return 1;
+   }
+
+// Fills the write buffers of both chips with the 64 bytes at SrcAddr. On
+// the DS the slot splits each 32 bit store into two 16 bit ones, to the
+// first chip and then the second, just like two 16 bit stores.
+static void FeedTurboFABuffer (u32 SrcAddr, u32 FlashAddr)
+   {
+   int i;
+
+#if !defined(HOST) && !defined(FLINKER)
+   if ((SrcAddr & 3) == 0)
+      {
+      u32 *Src = (u32 *)SrcAddr;
+      vu32 *Dest = (vu32 *)FlashAddr;
+      for (i=0; i<16; i+=4)
+         {
+         Dest[i] = Src[i];
+         Dest[i+1] = Src[i+1];
+         Dest[i+2] = Src[i+2];
+         Dest[i+3] = Src[i+3];
+         }
+      return;
+      }
+#endif
+   for (i=0; i<32; i++)
+      {
+      WRITE_FLASH_NEXT(FlashAddr,*(u16 *)SrcAddr);
+      SrcAddr += 2;
+      FlashAddr += _MEM_INC;
+      }
+   }
+
 // Write 64 x Length bytes to newer (Turbo) FA/Visoly flash cart.
 // Function returns true if write was successful.
 
 u32 WriteTurboFACart (u32 SrcAddr, u32 FlashAddr, u32 Length)
    {
-   int i,k;
+   int k;
    int done1,done2;
    int Timeout;
    int Ready = 0;
@@ -614,6 +791,15 @@ u32 WriteTurboFACart (u32 SrcAddr, u32 FlashAddr, u32 Length)
 
    while (LoopCount < Length)
       {
+      if (IsBlankTurboFABuffer (SrcAddr))
+         {
+         SrcAddr += 64;
+         FlashAddr += 32 * _MEM_INC;
+         Ready = 1;
+         LoopCount++;
+         continue;
+         }
+
       done1 = 0;
       done2 = 0;
       Ready = 0;
@@ -639,12 +825,9 @@ u32 WriteTurboFACart (u32 SrcAddr, u32 FlashAddr, u32 Length)
 
          SET_CART_ADDR(FlashAddr);
 
-         for (i=0; i<32; i++)
-            {
-            WRITE_FLASH_NEXT(FlashAddr,*(u16 *)SrcAddr);
-            SrcAddr += 2;
-            FlashAddr += _MEM_INC;
-            }
+         FeedTurboFABuffer (SrcAddr, FlashAddr);
+         SrcAddr += 64;
+         FlashAddr += 32 * _MEM_INC;
          WRITE_FLASH_NEXT(FlashAddr,INTEL28F_CONFIRM);
          WRITE_FLASH_NEXT(FlashAddr+_MEM_INC,INTEL28F_CONFIRM);
 
@@ -655,7 +838,7 @@ u32 WriteTurboFACart (u32 SrcAddr, u32 FlashAddr, u32 Length)
          while (((k & 0x8080) != 0x8080) && (Timeout != 0))
             {
             READ_TURBO_S(k);
-            Ready = (k == 0x8080);
+            Ready = ((k & ~0x4040) == 0x8080);   // an erase may be suspended
 
             Timeout--;
             }
@@ -10,6 +10,10 @@ extern void SetVisolyFlashRWMode (void);
 extern u8 CartTypeDetect (void);
 extern u32 EraseTurboFABlocks (u32 StartAddr, u32 BlockCount);
 extern u32 WriteTurboFACart(u32 SrcAddr, u32 FlashAddr, u32 Length);
+extern u32 StartTurboFAErase (u32 BlockAddr);
+extern u32 PollTurboFAErase (void);
+extern u32 SuspendTurboFAErase (void);
+extern void ResumeTurboFAErase (void);
 
 extern void VisolySetFlashBaseAddress(u32 offset);
 
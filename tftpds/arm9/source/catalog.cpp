@@ -0,0 +1,323 @@
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include "catalog.h"
+#include "nintendologo.h"
+#include "cartlib.h"
+#include "flashengine.h"
+#include "metrics.h"
+
+typedef char CatalogHeaderFits[sizeof(CatalogHeader) == CATALOG_ENTRY_SIZE ? 1 : -1];
+typedef char CatalogEntryFits[sizeof(CatalogEntry) == CATALOG_ENTRY_SIZE ? 1 : -1];
+// Create lists every block before the catalog
+typedef char CatalogListsCart[CATALOG_OFFSET / CATALOG_SIZE <= CATALOG_MAX_ENTRIES ? 1 : -1];
+
+#define CATALOG_BASE (CART_BASE + CATALOG_OFFSET)
+#define CATALOG_ENTRIES ((CatalogEntry*)(CATALOG_BASE + CATALOG_ENTRY_SIZE))
+// all of the cart that the gba slot shows
+#define CATALOG_SCAN_END 0x2000000
+
+static Counter entriesWritten("catalog_entries_written");
+static Counter catalogsCreated("catalogs_created");
+
+// what is programmed, aligned for the 32 bit stores
+static CatalogEntry programmed;
+static bool failed;
+// the catalog was full, and its block is queued to be erased
+static bool rebuilding = false;
+
+Filetype Catalog::Identify(const u8* address, char* title)
+{
+	bool pass = (memcmp("PASS", address+0xAC, 4) == 0);
+	bool gbalogo = (memcmp(nintendo_logo, address+0x4, sizeof(nintendo_logo)) == 0);
+	bool loader = (memcmp("NDS loader for GBA flashcards", address+0x21, 29) == 0);
+
+	memset(title, 0, CATALOG_TITLE_LENGTH + 1);
+	if(loader || (pass && gbalogo))
+	{
+		strncpy(title, (const char*)address+0xA0, CATALOG_TITLE_LENGTH);
+		return FILETYPE_DS_GBA;
+	}
+	else if(pass)
+	{
+		strcpy(title, "unknown");
+		return FILETYPE_NDS;
+	}
+	else if(gbalogo)
+	{
+		strncpy(title, (const char*)address+0xA0, CATALOG_TITLE_LENGTH);
+		return FILETYPE_GBA;
+	}
+	return FILETYPE_NONE;
+}
+
+int Catalog::List(CatalogEntry* entries, int maxEntries)
+{
+	if(rebuilding)
+	{
+		Rebuild();
+	}
+	if(!IsValid())
+	{
+		return Scan(entries, maxEntries);
+	}
+
+	int count = 0;
+	const CatalogEntry* last = CATALOG_ENTRIES + CATALOG_MAX_ENTRIES;
+	for(const CatalogEntry* entry = CATALOG_ENTRIES; entry < last && entry->offset != CATALOG_UNUSED; entry++)
+	{
+		// anything that isn't there anymore, like the start of a transfer
+		// that failed, is left out
+		char title[CATALOG_TITLE_LENGTH + 1];
+		if(entry->replaced != CATALOG_UNUSED ||
+			entry->offset >= CATALOG_OFFSET ||
+			(entry->offset & (CATALOG_SIZE - 1)) != 0 ||
+			Identify(CART_BASE + entry->offset, title) != (Filetype)entry->filetype)
+		{
+			continue;
+		}
+
+		// the ones with the lowest offsets, in order
+		int i = count;
+		while(i > 0 && entries[i - 1].offset > entry->offset)
+		{
+			if(i < maxEntries)
+			{
+				entries[i] = entries[i - 1];
+			}
+			i--;
+		}
+		if(i < maxEntries)
+		{
+			entries[i] = *entry;
+			entries[i].title[CATALOG_TITLE_LENGTH] = '\0';
+			if(count < maxEntries)
+			{
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+void Catalog::Update(u8* start, int length, u8* end, u8* cartEnd)
+{
+	u8* catalog = CATALOG_BASE;
+	if(cartEnd < catalog + CATALOG_SIZE || end > catalog)
+	{
+		// no room for one, or the file was written over it
+		rebuilding = false;
+		return;
+	}
+	if(rebuilding)
+	{
+		// the new catalog lists this file too
+		Rebuild();
+		return;
+	}
+
+	failed = false;
+	FlashEngine::Suspend();
+	bool full = Record(start, length, end);
+	FlashEngine::Resume();
+
+	if(full)
+	{
+		// the block is known to be the catalog, which starts over with
+		// what is on the cart once it is erased
+		FlashEngine::Erase(catalog, 1);
+		rebuilding = true;
+	}
+
+	if(failed)
+	{
+		throw "Failed to write the catalog";
+	}
+}
+
+bool Catalog::Step()
+{
+	if(!rebuilding)
+	{
+		return false;
+	}
+
+	u8* catalog = CATALOG_BASE;
+	bool busy = FlashEngine::Step();
+	try
+	{
+		if(!FlashEngine::IsErased(catalog, catalog + CATALOG_SIZE))
+		{
+			return busy;
+		}
+	}
+	catch(const char* exception)
+	{
+		printf("Error: %s\n", exception);
+		rebuilding = false;
+		return true;
+	}
+	Rebuild();
+	return true;
+}
+
+// Writes the catalog anew from what is on the cart, waiting for its block
+// to be erased first.
+void Catalog::Rebuild()
+{
+	u8* catalog = CATALOG_BASE;
+	rebuilding = false;
+	try
+	{
+		FlashEngine::WaitErased(catalog, catalog + CATALOG_SIZE);
+	}
+	catch(const char* exception)
+	{
+		printf("Error: %s\n", exception);
+		return;
+	}
+
+	failed = false;
+	FlashEngine::Suspend();
+	Create();
+	FlashEngine::Resume();
+	if(failed)
+	{
+		printf("Error: Failed to write the catalog\n");
+	}
+}
+
+bool Catalog::IsValid()
+{
+	const CatalogHeader* header = (const CatalogHeader*)CATALOG_BASE;
+	return memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) == 0 &&
+		header->version == CATALOG_VERSION;
+}
+
+bool Catalog::IsBlank()
+{
+	const u32* word = (const u32*)CATALOG_BASE;
+	const u32* blockEnd = (const u32*)(CATALOG_BASE + CATALOG_SIZE);
+	while(word < blockEnd && *word == CATALOG_UNUSED)
+	{
+		word++;
+	}
+	return word == blockEnd;
+}
+
+// Looks at the start of every block of the cart instead.
+int Catalog::Scan(CatalogEntry* entries, int maxEntries)
+{
+	int count = 0;
+	for(u32 offset = 0; count < maxEntries && offset < CATALOG_SCAN_END; offset += CATALOG_SIZE)
+	{
+		CatalogEntry* entry = &entries[count];
+		memset(entry, 0xFF, sizeof(CatalogEntry));
+		entry->filetype = Identify(CART_BASE + offset, entry->title);
+		if(entry->filetype != FILETYPE_NONE)
+		{
+			entry->offset = offset;
+			entry->length = 0;
+			count++;
+		}
+	}
+	return count;
+}
+
+// Returns true if the catalog is full.
+bool Catalog::Record(u8* start, int length, u8* end)
+{
+	if(!IsValid())
+	{
+		// the block is only taken for the catalog if there is nothing in
+		// it, and never erased for it
+		if(IsBlank())
+		{
+			Create();
+		}
+		return false;
+	}
+
+	char title[CATALOG_TITLE_LENGTH + 1];
+	Filetype filetype = Identify(start, title);
+	u32 offset = start - CART_BASE;
+	bool listed = false;
+
+	CatalogEntry* entry = CATALOG_ENTRIES;
+	CatalogEntry* last = CATALOG_ENTRIES + CATALOG_MAX_ENTRIES;
+	for(; entry < last && entry->offset != CATALOG_UNUSED; entry++)
+	{
+		if(entry->replaced != CATALOG_UNUSED)
+		{
+			continue;
+		}
+		if(entry->offset == offset && entry->filetype == (u32)filetype &&
+			entry->length == (u32)length && strcmp(entry->title, title) == 0)
+		{
+			// the same file again
+			listed = true;
+		}
+		else if(entry->offset >= offset && CART_BASE + entry->offset < end)
+		{
+			memcpy(&programmed, entry, sizeof(CatalogEntry));
+			programmed.replaced = 0;
+			Program(&programmed, (u8*)entry);
+		}
+	}
+
+	if(filetype == FILETYPE_NONE || listed)
+	{
+		return false;
+	}
+	if(entry == last)
+	{
+		return true;
+	}
+
+	memset(&programmed, 0xFF, sizeof(CatalogEntry));
+	programmed.offset = offset;
+	programmed.length = length;
+	programmed.filetype = filetype;
+	memset(programmed.title, 0, sizeof(programmed.title));
+	strcpy(programmed.title, title);
+	Program(&programmed, (u8*)entry);
+	entriesWritten.Increment();
+	return false;
+}
+
+// Writes the header to the erased block, and an entry for each image on
+// the cart, with no length since their headers may not have one.
+void Catalog::Create()
+{
+	CatalogHeader* header = (CatalogHeader*)&programmed;
+	memset(header, 0xFF, sizeof(CatalogHeader));
+	memcpy(header->magic, CATALOG_MAGIC, sizeof(header->magic));
+	header->version = CATALOG_VERSION;
+	Program(header, CATALOG_BASE);
+
+	CatalogEntry* entry = CATALOG_ENTRIES;
+	for(u32 offset = 0; offset < CATALOG_OFFSET; offset += CATALOG_SIZE)
+	{
+		memset(&programmed, 0xFF, sizeof(CatalogEntry));
+		memset(programmed.title, 0, sizeof(programmed.title));
+		programmed.filetype = Identify(CART_BASE + offset, programmed.title);
+		if(programmed.filetype != FILETYPE_NONE)
+		{
+			programmed.offset = offset;
+			programmed.length = 0;
+			Program(&programmed, (u8*)entry);
+			entry++;
+			entriesWritten.Increment();
+		}
+	}
+	catalogsCreated.Increment();
+	printf("Catalog of %i files written\n", (int)(entry - CATALOG_ENTRIES));
+}
+
+void Catalog::Program(const void* source, u8* address)
+{
+	if(!WriteTurboFACart(ADDRESS(source), ADDRESS(address), 1))
+	{
+		failed = true;
+	}
+}
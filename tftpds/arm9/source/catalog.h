@@ -0,0 +1,38 @@
+#pragma once
+
+#include "platform.h"
+#include "catalogformat.h"
+
+// What is on the flash cart, so that the boot menus don't have to look at
+// every block of it. The catalog is the header, followed by an entry for
+// each image written since. Flash can only be programmed from 1 to 0
+// without erasing a whole block, so entries are only ever added, or marked
+// replaced, and the catalog is only erased when it is full. If there is
+// something else where the catalog should be, the cart is looked through
+// instead.
+class Catalog
+{
+public:
+	// Returns what kind of image is at address, and its title.
+	static Filetype Identify(const u8* address, char* title);
+	// Fills entries with up to maxEntries images on the cart, ordered by
+	// offset, from the catalog if there is one. Returns how many.
+	static int List(CatalogEntry* entries, int maxEntries);
+	// Records the length bytes written from start, if they are an image,
+	// and that what was listed from there up to end is gone. Only for
+	// files that were written all the way. A full catalog is queued to be
+	// erased, and written anew by Step, since the erase takes a second.
+	static void Update(u8* start, int length, u8* end, u8* cartEnd);
+	// Writes the catalog anew once its block is erased. Only while no file
+	// is open. Returns true if anything happened.
+	static bool Step();
+
+private:
+	static void Rebuild();
+	static bool IsValid();
+	static bool IsBlank();
+	static int Scan(CatalogEntry* entries, int maxEntries);
+	static bool Record(u8* start, int length, u8* end);
+	static void Create();
+	static void Program(const void* source, u8* address);
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+// How the catalog is laid out on the cart, for tftpds, which writes it,
+// and the gba menu, which only reads it (see catalog.h). Uses u8 and u32,
+// which both libnds and libgba have.
+
+// the last erase block of a Turbo FA 256M, where the gba menu can find it
+#define CATALOG_OFFSET 0x1FC0000
+#define CATALOG_SIZE 0x40000
+#define CATALOG_VERSION 1
+#define CATALOG_MAGIC "TFTPDSCT"
+// both the header and the entries are one flash write block
+#define CATALOG_ENTRY_SIZE 0x40
+#define CATALOG_MAX_ENTRIES (CATALOG_SIZE / CATALOG_ENTRY_SIZE - 1)
+#define CATALOG_TITLE_LENGTH 12
+// what flash is erased to
+#define CATALOG_UNUSED 0xFFFFFFFF
+
+enum Filetype
+{
+	FILETYPE_NONE = 0,
+	FILETYPE_GBA,
+	FILETYPE_NDS,
+	FILETYPE_DS_GBA
+};
+
+struct CatalogHeader
+{
+	char magic[8];
+	u32 version;
+	u8 unused[CATALOG_ENTRY_SIZE - 12];
+} __attribute__((packed, aligned(4)));
+
+struct CatalogEntry
+{
+	u32 offset;     // CATALOG_UNUSED in a slot that isn't used yet
+	u32 length;     // 0 if it isn't known
+	u32 filetype;
+	u32 replaced;   // programmed to 0 when a file is written over it
+	char title[16];
+	u8 unused[CATALOG_ENTRY_SIZE - 32];
+} __attribute__((packed, aligned(4)));
@@ -0,0 +1,57 @@
+#include <nds.h>
+#include "clock.h"
+
+// 33.514 MHz / 1024
+#define CLOCK_FREQUENCY 32728
+
+static u32 lastTicks = 0;
+static u64 totalTicks = 0;
+
+// Makes a free running 32 bit timer out of timer 0 and 1, ticking about
+// every 30 microseconds.
+void StartClock()
+{
+	TIMER0_CR = 0;
+	TIMER1_CR = 0;
+	TIMER0_DATA = 0;
+	TIMER1_DATA = 0;
+	TIMER0_CR = TIMER_ENABLE | TIMER_DIV_1024;
+	TIMER1_CR = TIMER_ENABLE | TIMER_CASCADE;
+
+	lastTicks = 0;
+	totalTicks = 0;
+}
+
+// The hardware timer wraps after 36 hours, so the clock must be read at
+// least that often to stay monotonic.
+static u64 GetTicks()
+{
+	// read the high half again, in case the low half overflowed in between
+	u16 high;
+	u16 low;
+	do
+	{
+		high = TIMER1_DATA;
+		low = TIMER0_DATA;
+	}
+	while(high != TIMER1_DATA);
+
+	u32 ticks = (high << 16) | low;
+	totalTicks += ticks - lastTicks;
+	lastTicks = ticks;
+
+	return totalTicks;
+}
+
+// Returns milliseconds since StartClock.
+u32 GetMillis()
+{
+	return (u32)(GetTicks() * 1000 / CLOCK_FREQUENCY);
+}
+
+// Returns microseconds since StartClock, in steps of about 30. It wraps
+// after 71 minutes, which is fine for measuring how long things take.
+u32 GetMicros()
+{
+	return (u32)(GetTicks() * 1000000 / CLOCK_FREQUENCY);
+}
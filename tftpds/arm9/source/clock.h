@@ -0,0 +1,10 @@
+#pragma once
+
+#include "platform.h"
+
+void StartClock();
+u32 GetMillis();
+u32 GetMicros();
+
+// true if time a is before time b, also when the clock has wrapped
+#define CLOCK_BEFORE(a, b) ((s32)((a) - (b)) < 0)
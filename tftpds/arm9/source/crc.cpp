@@ -0,0 +1,35 @@
+#include "platform.h"
+#include "crc.h"
+
+static u32 table[256];
+static bool tableMade = false;
+
+static void MakeTable()
+{
+	for(u32 i = 0; i < 256; i++)
+	{
+		u32 crc = i;
+		for(int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+		}
+		table[i] = crc;
+	}
+	tableMade = true;
+}
+
+u32 Crc32(u32 crc, const void* data, int length)
+{
+	if(!tableMade)
+	{
+		MakeTable();
+	}
+
+	const u8* ptr = (const u8*)data;
+	crc = ~crc;
+	for(int i = 0; i < length; i++)
+	{
+		crc = table[(crc ^ ptr[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "platform.h"
+
+// Adds length bytes at data to the CRC-32 (as in zip and png) crc of what
+// came before them, which is 0 for nothing.
+u32 Crc32(u32 crc, const void* data, int length);
@@ -7,12 +7,46 @@ enum FileState
 	FILESTATE_CLOSED
 };
 
+// How much of what is written is read back to check it.
+enum VerifyPolicy
+{
+	VERIFY_FULL,      // all of it, and the whole file again at the end
+	VERIFY_BLOCK,     // all of it, once per erase block
+	VERIFY_SAMPLED,   // some of each erase block
+	VERIFY_OFF
+};
+
 class File
 {
 public:
 	virtual ~File() {};
 
+	// Returns how many bytes were read, which is less than length only at
+	// the end of the file, or -1 if none can be read until Step has got on
+	// with the work they need.
 	virtual int Read(void* dest, int length) = 0;
 	virtual void Write(void* source, int length) = 0;
 	virtual void Close() = 0;
+
+	// Writes as much of source as can be written straight from where it is,
+	// and returns how much that was. The rest must be passed again in the
+	// next call, followed by more data, at the same address modulo 64.
+	virtual int WriteDirect(void* source, int length) { Write(source, length); return length; };
+
+	// Returns where the next bytes of the file can be read in place, and
+	// moves past up to length of them like Read. *mapped is set to how many
+	// that was. Returns NULL if the file can't be mapped, in which case Read
+	// must be used.
+	virtual const void* Map(int length, int* mapped) { return NULL; };
+
+	// Tells how much is going to be written, before the first Write.
+	virtual void SetLength(int length) {};
+	// Tells how to check what is written, before the first Write.
+	virtual void SetVerify(VerifyPolicy policy) {};
+	// Returns the length of the file, or -1 if it isn't known.
+	virtual int GetLength() { return -1; };
+
+	// Gets on with work that doesn't have to wait for the next Write, like
+	// erasing. Returns true if anything was done.
+	virtual bool Step() { return false; };
 };
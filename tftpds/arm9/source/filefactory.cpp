@@ -1,12 +1,24 @@
-#include <nds.h>
+#include "platform.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <new>
 #include "filefactory.h"
 #include "flashcartfile.h"
+#include "hashfile.h"
+#include "lzfile.h"
 #include "sramfile.h"
+#include "statsfile.h"
+#include "tracefile.h"
 
-File* FileFactory::OpenFile(const char* filename, bool write)
+typedef char FlashCartFileFits[sizeof(FlashCartFile) <= FILEFACTORY_STORAGE_SIZE ? 1 : -1];
+typedef char HashFileFits[sizeof(HashFile) <= FILEFACTORY_STORAGE_SIZE ? 1 : -1];
+typedef char LzFileFits[sizeof(LzFile) <= FILEFACTORY_STORAGE_SIZE ? 1 : -1];
+typedef char SramFileFits[sizeof(SramFile) <= FILEFACTORY_STORAGE_SIZE ? 1 : -1];
+typedef char StatsFileFits[sizeof(StatsFile) <= FILEFACTORY_STORAGE_SIZE ? 1 : -1];
+typedef char TraceFileFits[sizeof(TraceFile) <= FILEFACTORY_STORAGE_SIZE ? 1 : -1];
+
+File* FileFactory::OpenFile(const char* filename, bool write, void* storage)
 {
 	char dir[11];
 	int offset = 0;
@@ -23,14 +35,43 @@ File* FileFactory::OpenFile(const char* filename, bool write)
 
 	if(strcmp(dir, "rom") == 0)
 	{
-		return new FlashCartFile(filename + offset, write);
+		// /rom/<offset>/hashes, when read
+		const char* name = strchr(filename + offset, '/');
+		if(!write && name != NULL && strncmp(name, "/hashes", 7) == 0 &&
+			(name[7] == '\0' || name[7] == '/'))
+		{
+			return new(storage) HashFile(filename + offset, write);
+		}
+		// /rom/<offset>/<name>.lz, when written
+		int length = (name != NULL) ? strlen(name) : 0;
+		if(write && length > 3 && strcmp(name + length - 3, ".lz") == 0)
+		{
+			return new(storage) LzFile(filename + offset, write);
+		}
+		return new(storage) FlashCartFile(filename + offset, write);
 	}
 	else if(strcmp(dir, "ram") == 0)
 	{
-		return new SramFile(filename + offset, write);
+		return new(storage) SramFile(filename + offset, write);
+	}
+	else if(strcmp(dir, "stats") == 0)
+	{
+		return new(storage) StatsFile(filename + offset, write);
+	}
+	else if(strcmp(dir, "trace") == 0)
+	{
+		return new(storage) TraceFile(filename + offset, write);
 	}
 	else
 	{
 		throw "Unknown path";
 	}
 }
+
+void FileFactory::CloseFile(File* file)
+{
+	if(file != NULL)
+	{
+		file->~File();
+	}
+}
@@ -2,8 +2,14 @@
 
 #include "file.h"
 
+// room needed for any of the files
+#define FILEFACTORY_STORAGE_SIZE 2048
+
 class FileFactory
 {
 public:
-	static File* OpenFile(const char* filename, bool write);
+	// Opens the file in storage, which must have room for
+	// FILEFACTORY_STORAGE_SIZE bytes. Use CloseFile instead of delete.
+	static File* OpenFile(const char* filename, bool write, void* storage);
+	static void CloseFile(File* file);
 };
@@ -1,17 +1,146 @@
-#include <nds.h>
+#include "platform.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "flashcartfile.h"
 #include "cartlib.h"
+#include "catalog.h"
+#include "flashengine.h"
+#include "clock.h"
+#include "crc.h"
+#include "metrics.h"
+
+static Counter bytesWritten("flashcart_bytes_written");
+static Counter bytesRead("flashcart_bytes_read");
+static Counter writeFailures("cartlib_write_failures");
+static Counter verifyFailures("cartlib_verify_failures");
+static Counter blocksSkipped("flashcart_blocks_skipped");
+static Histogram writeTime("cartlib_write_us");
+static Histogram verifyTime("cartlib_verify_us");
+
+// A copy of the block being compared, for the one file that compares.
+// A block can only be erased whole, so up to all of it has to be kept to be
+// programmed again, which is why it is only there while comparing is turned
+// on.
+static u8* savedBlock = NULL;
+static FlashCartFile* savedOwner = NULL;
+
+// Returns true if there is a GBA header at address, which has no length in
+// it, but a checksum that tells it apart from any other data.
+static bool IsGbaHeader(const u8* address)
+{
+	if(address[0xB2] != 0x96)
+	{
+		return false;
+	}
+	u8 sum = 0;
+	for(int i = 0xA0; i < 0xBD; i++)
+	{
+		sum += address[i];
+	}
+	return (u8)(-(sum + 0x19)) == address[0xBD];
+}
+
+static bool IsLoader(const u8* address)
+{
+	return memcmp(address + 0x21, "NDS loader for GBA flashcards", 29) == 0;
+}
+
+// Where an image that has no length in its header ends: at the last byte
+// that isn't 0xff, in the first block that ends in 0xff or is followed by
+// another image. The rest of the last block of a file is always erased, so
+// only a file that fills its last block can be taken to go on.
+static u8* TrimBlank(u8* start, u8* cartEnd)
+{
+	u8* blockEnd = (u8*)(((size_t)start & ~FLASHCART_ERASE_BLOCK_SIZE_MASK) + FLASHCART_ERASE_BLOCK_SIZE);
+	while(blockEnd < cartEnd && *(u16*)(blockEnd - 2) != 0xFFFF &&
+		!IsGbaHeader(blockEnd) && !IsLoader(blockEnd) && memcmp(blockEnd + 0xAC, "PASS", 4) != 0)
+	{
+		blockEnd += FLASHCART_ERASE_BLOCK_SIZE;
+	}
+
+	u8* end = blockEnd;
+	while(end > start && end[-1] == 0xFF)
+	{
+		end--;
+	}
+	return end;
+}
+
+// Where the file at start ends, by the .nds header for .nds and .ds.gba
+// files, and the gba menu after it, or by TrimBlank for .gba files. For
+// anything else, reading goes on to the end of the cart.
+static u8* FindEnd(u8* start, u8* cartEnd)
+{
+	u8* nds = NULL;
+	if(IsLoader(start))
+	{
+		nds = start + FLASHCART_LOADER_SIZE;
+	}
+	else if(memcmp(start + 0xAC, "PASS", 4) == 0)
+	{
+		nds = start;
+	}
+
+	if(nds != NULL)
+	{
+		u32 size = *(u32*)(nds + FLASHCART_NDS_ROM_SIZE);
+		if(size < 0x200 || size > (u32)(cartEnd - nds))
+		{
+			return cartEnd;
+		}
+		u8* end = nds + size;
+		if(cartEnd - end >= 0xC0 && IsGbaHeader(end))
+		{
+			end = TrimBlank(end, cartEnd);
+		}
+		return end;
+	}
+	if(IsGbaHeader(start))
+	{
+		return TrimBlank(start, cartEnd);
+	}
+	return cartEnd;
+}
 
 FlashCartFile::FlashCartFile(const char* filename, bool write)
 :	bufferFill(0),
+	fileStart(NULL),
 	filePtr(NULL),
 	erasePtr(NULL),
-	state(write ? FILESTATE_WRITE : FILESTATE_READ)
+	cartEnd(NULL),
+	fileEnd(NULL),
+	writeEnd(NULL),
+	locked(false),
+	state(write ? FILESTATE_WRITE : FILESTATE_READ),
+	verify(VERIFY_BLOCK),
+	blockStart(NULL),
+	blockCrc(0),
+	fileCrc(0),
+	fileTracked(true),
+	verifyStart(NULL),
+	verifyPtr(NULL),
+	verifyEnd(NULL),
+	verifyCrc(0),
+	expectedCrc(0),
+	delta(false),
+	copiedBlock(NULL),
+	savedPtr(savedBlock),
+	savedEnd(savedBlock),
+	skipped(0)
 {
-	DetectFlashCart();
+	// the chips can tell what they are while erasing is suspended
+	FlashEngine::Suspend();
+	try
+	{
+		DetectFlashCart();
+	}
+	catch(...)
+	{
+		FlashEngine::Resume();
+		throw;
+	}
+	FlashEngine::Resume();
 
 	int offset;
 	int end;
@@ -26,9 +155,32 @@ FlashCartFile::FlashCartFile(const char* filename, bool write)
 		throw "Unsupported offset";
 	}
 
-	printf("Writing at offset 0x%x\n", offset);
-	filePtr = erasePtr = (u8*)0x08000000 + offset;
+	printf("%s at offset 0x%x\n", write ? "Writing" : "Reading", offset);
+	fileStart = filePtr = erasePtr = blockStart = CART_BASE + offset;
 	bufferFill = 0;
+
+	if(!write)
+	{
+		FlashEngine::Lock();
+		locked = true;
+
+		// the length can be given after the name, e.g. 100000/x/80000
+		int length;
+		if(sscanf(filename + end, "%*[^/]/%x", &length) == 1)
+		{
+			fileEnd = (length < cartEnd - fileStart) ? fileStart + length : cartEnd;
+		}
+		else
+		{
+			fileEnd = FindEnd(fileStart, cartEnd);
+		}
+	}
+	else if(savedOwner == NULL && savedBlock != NULL)
+	{
+		// any other file written at the same time is erased as it comes
+		savedOwner = this;
+		delta = true;
+	}
 }
 
 FlashCartFile::~FlashCartFile()
@@ -37,7 +189,8 @@ FlashCartFile::~FlashCartFile()
 	{
 		try
 		{
-			Close();
+			// the transfer didn't finish
+			DoClose(false);
 		}
 		catch(...)
 		{
@@ -51,6 +204,7 @@ void FlashCartFile::DetectFlashCart()
 
 	printf("Detecting flash type:\n");
 	bool isVisolyTurbo = false;
+	int size = 0;
 	int type = CartTypeDetect();
 	switch(type)
 	{
@@ -58,9 +212,9 @@ void FlashCartFile::DetectFlashCart()
 	case 0x17 : printf ("  FA 64M\n");  break;
 	case 0x18 : printf ("  FA 128M\n"); break;
 	case 0x2e : printf ("  Standard ROM\n");         break;
-	case 0x96 : printf ("  Turbo FA 64M\n");  isVisolyTurbo=1; break;
-	case 0x97 : printf ("  Turbo FA 128M\n"); isVisolyTurbo=1; break;
-	case 0x98 : printf ("  Turbo FA 256M\n"); isVisolyTurbo=1; break;
+	case 0x96 : printf ("  Turbo FA 64M\n");  isVisolyTurbo=1; size=0x800000;  break;
+	case 0x97 : printf ("  Turbo FA 128M\n"); isVisolyTurbo=1; size=0x1000000; break;
+	case 0x98 : printf ("  Turbo FA 256M\n"); isVisolyTurbo=1; size=0x2000000; break;
 	case 0xdc : printf ("  Hudson\n");               break;
 	case 0xe2 : printf ("  Nintendo Flash Cart\n");  break;
 	default   : printf ("  Unknown\n");              break;
@@ -68,15 +222,42 @@ void FlashCartFile::DetectFlashCart()
 
 	if(!isVisolyTurbo)
 	{
-		char e[1024];
+		// static, since the exception outlives this function
+		static char e[1024];
 		sprintf(e, "Unsupported flashcart (0x%x)", type);
 		throw e;
 	}
+
+	cartEnd = CART_BASE + size;
 }
 
 int FlashCartFile::Read(void* dest, int length)
 {
-	throw "Reading from flash cart not supported.";
+	int mapped;
+	const void* source = Map(length, &mapped);
+	memcpy(dest, source, mapped);
+	bytesRead.Add(mapped);
+	return mapped;
+}
+
+// The cart is in the address space, so reading is just a matter of handing
+// out pointers. Everything up to the end of the file is read.
+const void* FlashCartFile::Map(int length, int* mapped)
+{
+	if(state != FILESTATE_READ)
+	{
+		throw "Illegal state.";
+	}
+
+	if(length > fileEnd - filePtr)
+	{
+		length = fileEnd - filePtr;
+	}
+
+	u8* source = filePtr;
+	filePtr += length;
+	*mapped = length;
+	return source;
 }
 
 void FlashCartFile::Write(void* source, int length)
@@ -100,7 +281,25 @@ void FlashCartFile::Write(void* source, int length)
 	}
 	if(tempLength > FLASHCART_WRITE_BLOCK_SIZE) {
 		int writeableLength = tempLength & ~FLASHCART_WRITE_BLOCK_SIZE_MASK;
-		DoWrite(dataPtr, writeableLength);
+		if(((size_t)dataPtr & 1) == 0)
+		{
+			DoWrite(dataPtr, writeableLength);
+		}
+		else
+		{
+			// the flash is written 16 bits at a time, so unaligned data has
+			// to go through the buffer
+			for(int i = 0; i < writeableLength; i += FLASHCART_BUFFER_SIZE)
+			{
+				int copyLength = writeableLength - i;
+				if(copyLength > FLASHCART_BUFFER_SIZE)
+				{
+					copyLength = FLASHCART_BUFFER_SIZE;
+				}
+				memcpy(buffer, dataPtr + i, copyLength);
+				DoWrite(buffer, copyLength);
+			}
+		}
 		tempLength -= writeableLength;
 		dataPtr += writeableLength;
 	}
@@ -109,58 +308,561 @@ void FlashCartFile::Write(void* source, int length)
 	bufferFill += tempLength;	
 }
 
-void FlashCartFile::Close()
+int FlashCartFile::WriteDirect(void* source, int length)
 {
-	if(state == FILESTATE_WRITE && bufferFill > 0)
+	if(state != FILESTATE_WRITE)
 	{
-		DoWrite(buffer, FLASHCART_WRITE_BLOCK_SIZE);
+		throw "Illegal state.";
+	}
+
+	// anything already in the buffer must be written first
+	if(bufferFill > 0 || ((size_t)source & 1) != 0)
+	{
+		Write(source, length);
+		return length;
+	}
+
+	int writeableLength = length & ~FLASHCART_WRITE_BLOCK_SIZE_MASK;
+	if(writeableLength > 0)
+	{
+		int compared = Compare((u8*)source, writeableLength);
+		if(compared > 0)
+		{
+			return compared;
+		}
+		if(savedPtr != savedEnd)
+		{
+			// what matched goes back first, a piece at a time, once the
+			// block is erased
+			if(FlashEngine::IsHandedOver() ||
+				FlashEngine::IsErased(filePtr, filePtr + (savedEnd - savedPtr)))
+			{
+				WriteSaved(FLASHCART_VERIFY_STEP);
+			}
+			return 0;
+		}
+		if(delta && filePtr < erasePtr && writeableLength > erasePtr - filePtr)
+		{
+			writeableLength = erasePtr - filePtr;
+		}
+
+		// while the blocks are being erased, the data waits where it is
+		EraseUpTo(filePtr + writeableLength);
+		if(FlashEngine::IsHandedOver())
+		{
+			// the ARM7 waits for the erase itself, but only takes as much
+			// as there is room for in the ring
+			int room = FlashEngine::GetRoom();
+			if(writeableLength > room)
+			{
+				writeableLength = room;
+			}
+			if(writeableLength == 0)
+			{
+				return 0;
+			}
+		}
+		else if(!FlashEngine::IsErased(filePtr, filePtr + writeableLength))
+		{
+			return 0;
+		}
+		DoWrite((u8*)source, writeableLength);
 	}
+	return writeableLength;
+}
 
+void FlashCartFile::Close()
+{
+	DoClose(true);
+}
+
+// Only a file that was written all the way goes in the catalog.
+void FlashCartFile::DoClose(bool complete)
+{
+	// closed also if the rest of it fails
+	FileState closing = state;
 	state = FILESTATE_CLOSED;
+	if(locked)
+	{
+		FlashEngine::Unlock();
+		locked = false;
+	}
+	if(savedOwner == this)
+	{
+		savedOwner = NULL;
+	}
+
+	if(closing == FILESTATE_WRITE)
+	{
+		int length = filePtr - fileStart + bufferFill;
+		if(bufferFill > 0)
+		{
+			// padded the way the flash is erased, so the padding isn't
+			// programmed
+			memset(buffer + bufferFill, 0xFF, FLASHCART_WRITE_BLOCK_SIZE - bufferFill);
+			DoWrite(buffer, FLASHCART_WRITE_BLOCK_SIZE);
+		}
+		if(filePtr > erasePtr)
+		{
+			// the file ends in a block that matched so far, which is only
+			// left alone if the rest of it is erased, as it would have been
+			memset(buffer, 0xFF, FLASHCART_BUFFER_SIZE);
+			u8* blockEnd = erasePtr + FLASHCART_ERASE_BLOCK_SIZE;
+			while(filePtr > erasePtr && filePtr < blockEnd)
+			{
+				int length = blockEnd - filePtr;
+				DoWrite(buffer, length < FLASHCART_BUFFER_SIZE ? length : FLASHCART_BUFFER_SIZE);
+			}
+		}
+		WriteSaved(savedEnd - savedPtr);
+		if(skipped > 0)
+		{
+			printf("%i unchanged blocks skipped\n", skipped);
+		}
+		QueueVerify(filePtr);
+		FinishVerify();
+		if(verify == VERIFY_FULL && fileTracked)
+		{
+			// once more, in case programming a block disturbed the ones
+			// before it
+			blockStart = fileStart;
+			blockCrc = fileCrc;
+			QueueVerify(filePtr);
+			FinishVerify();
+		}
+		FlashEngine::Flush();
+		CheckProgrammed();
+
+		if(complete)
+		{
+			// for the boot menus, along with the blocks that were erased
+			Catalog::Update(fileStart, length, (filePtr > erasePtr) ? filePtr : erasePtr, cartEnd);
+		}
+	}
+}
+
+void FlashCartFile::UseDelta(bool use)
+{
+	if(use && savedBlock == NULL)
+	{
+		savedBlock = new u8[FLASHCART_ERASE_BLOCK_SIZE];
+	}
+	else if(!use)
+	{
+		delete[] savedBlock;
+		savedBlock = NULL;
+	}
+}
+
+bool FlashCartFile::IsUsingDelta()
+{
+	return savedBlock != NULL;
 }
 
+// Queues everything that is going to be written to be erased, so that each
+// block is erased while the ones before it are received.
+void FlashCartFile::SetLength(int length)
+{
+	if(state != FILESTATE_WRITE)
+	{
+		throw "Illegal state.";
+	}
+
+	if(filePtr + length > cartEnd)
+	{
+		throw "File too large for flash cart.";
+	}
+
+	// the blocks that are compared are erased once they differ
+	writeEnd = filePtr + length;
+	if(!delta)
+	{
+		EraseAhead();
+	}
+}
+
+// Queues the rest of the file to be erased, if its length is known.
+void FlashCartFile::EraseAhead()
+{
+	if(writeEnd > erasePtr)
+	{
+		int blockCount = (writeEnd - erasePtr + FLASHCART_ERASE_BLOCK_SIZE_MASK) / FLASHCART_ERASE_BLOCK_SIZE;
+		printf("Erasing %i blocks\n", blockCount);
+		EraseUpTo(writeEnd);
+	}
+}
+
+void FlashCartFile::SetVerify(VerifyPolicy policy)
+{
+	if(state != FILESTATE_WRITE)
+	{
+		throw "Illegal state.";
+	}
+	verify = policy;
+}
+
+int FlashCartFile::GetLength()
+{
+	if(state != FILESTATE_READ)
+	{
+		return -1;
+	}
+	return fileEnd - fileStart;
+}
+
+bool FlashCartFile::Step()
+{
+	if(state != FILESTATE_WRITE)
+	{
+		return false;
+	}
+	bool busy = FlashEngine::Step();
+	return VerifyStep(FLASHCART_VERIFY_STEP) || busy;
+}
+
+// Writes source at filePtr, unless it is already there.
 void FlashCartFile::DoWrite(u8* source, int length)
 {
-	while(filePtr + length > erasePtr)
+	while(length > 0)
 	{
-		EraseNextBlock();
+		int compared = Compare(source, length);
+		source += compared;
+		length -= compared;
+		if(length == 0)
+		{
+			return;
+		}
+
+		// the next block is compared before it is erased
+		int part = length;
+		if(delta && filePtr < erasePtr && part > erasePtr - filePtr)
+		{
+			part = erasePtr - filePtr;
+		}
+		WriteSaved(savedEnd - savedPtr);
+		Program(source, part);
+		source += part;
+		length -= part;
 	}
+}
+
+// Programs the erased flash while the erase of the blocks after it is
+// suspended, or queues it for the ARM7 to do.
+void FlashCartFile::Program(u8* source, int length)
+{
+	EraseUpTo(filePtr + length);
+	CheckProgrammed();
+	if(FlashEngine::Program(source, filePtr, length, verify != VERIFY_OFF))
+	{
+		// the ARM7 compares what it programs itself
+		QueueVerify(filePtr);
+		filePtr += length;
+		blockStart = filePtr;
+		fileTracked = false;
+		bytesWritten.Add(length);
+		return;
+	}
+	FlashEngine::WaitErased(filePtr, filePtr + length);
 
 	int blockCount = length / FLASHCART_WRITE_BLOCK_SIZE;
 
+	FlashEngine::Suspend();
+	u32 start = GetMicros();
 	int result = WriteTurboFACart(
-		(u32)source,
-		(u32)filePtr,
+		ADDRESS(source),
+		ADDRESS(filePtr),
 		blockCount);
+	writeTime.Record(GetMicros() - start);
+	FlashEngine::Resume();
+
 	if(!result)
 	{
-		char e[1024];
-		sprintf(e, "Failed to write flash at 0x%x", (u32)filePtr);
+		writeFailures.Increment();
+		static char e[1024];
+		sprintf(e, "Failed to write flash at 0x%x", ADDRESS(filePtr));
 		throw e;
 	}
 
-	result = memcmp(source, filePtr, length);
-	if(result != 0)
+	Track(source, length);
+	filePtr += length;
+	bytesWritten.Add(length);
+}
+
+// Adds what is written at filePtr to the CRCs that it is checked against,
+// and queues each erase block to be read back as soon as it is written.
+void FlashCartFile::Track(u8* source, int length)
+{
+	if(verify == VERIFY_OFF)
+	{
+		return;
+	}
+
+	u8* address = filePtr;
+	while(length > 0)
 	{
-		char e[1024];
-		sprintf(e, "Verify failed at 0x%x", (u32)filePtr);
-		throw e;
+		u8* blockEnd = (u8*)(((size_t)address & ~FLASHCART_ERASE_BLOCK_SIZE_MASK) + FLASHCART_ERASE_BLOCK_SIZE);
+		int part = (length < blockEnd - address) ? length : blockEnd - address;
+		blockCrc = Checksum(blockCrc, source, address, part);
+		if(verify == VERIFY_FULL)
+		{
+			fileCrc = Crc32(fileCrc, source, part);
+		}
+
+		source += part;
+		address += part;
+		length -= part;
+		if(address == blockEnd)
+		{
+			QueueVerify(address);
+		}
 	}
+}
 
-	filePtr += length;
+// The CRC of data, which is or will be at address, of the parts of it
+// that are read back.
+u32 FlashCartFile::Checksum(u32 crc, const u8* data, const u8* address, int length)
+{
+	if(verify != VERIFY_SAMPLED)
+	{
+		return Crc32(crc, data, length);
+	}
+
+	for(int i = 0; i < length; i += FLASHCART_WRITE_BLOCK_SIZE)
+	{
+		if((ADDRESS(address + i) / FLASHCART_WRITE_BLOCK_SIZE) % FLASHCART_VERIFY_SAMPLE == 0)
+		{
+			crc = Crc32(crc, data + i, FLASHCART_WRITE_BLOCK_SIZE);
+		}
+	}
+	return crc;
 }
 
-void FlashCartFile::EraseNextBlock()
+// Queues what has been written from blockStart up to end to be read back,
+// once the one before it is done.
+void FlashCartFile::QueueVerify(u8* end)
 {
-	int result = EraseTurboFABlocks(
-		(u32)erasePtr,
-		1);
-	if(!result)
+	if(verify == VERIFY_OFF || end == blockStart)
+	{
+		return;
+	}
+
+	FinishVerify();
+	verifyStart = verifyPtr = blockStart;
+	verifyEnd = end;
+	verifyCrc = 0;
+	expectedCrc = blockCrc;
+	blockStart = end;
+	blockCrc = 0;
+}
+
+// Reads back up to length bytes of what is queued to be verified. Returns
+// true if there was anything. Throws when it doesn't match.
+bool FlashCartFile::VerifyStep(int length)
+{
+	if(verifyPtr == verifyEnd)
+	{
+		return false;
+	}
+
+	if(length > verifyEnd - verifyPtr)
+	{
+		length = verifyEnd - verifyPtr;
+	}
+
+	FlashEngine::Suspend();
+	u32 start = GetMicros();
+	verifyCrc = Checksum(verifyCrc, verifyPtr, verifyPtr, length);
+	verifyTime.Record(GetMicros() - start);
+	FlashEngine::Resume();
+
+	verifyPtr += length;
+	if(verifyPtr == verifyEnd && verifyCrc != expectedCrc)
 	{
-		char e[1024];
-		sprintf(e, "Failed to erase flash at 0x%x", (u32)erasePtr);
+		verifyFailures.Increment();
+		static char e[1024];
+		sprintf(e, "Verify failed at 0x%x", ADDRESS(verifyStart));
 		throw e;
 	}
+	return true;
+}
+
+void FlashCartFile::FinishVerify()
+{
+	while(VerifyStep(FLASHCART_ERASE_BLOCK_SIZE))
+	{
+	}
+}
+
+// Returns how much of data, in whole write blocks, is already at address.
+// Aligned data is compared a word at a time.
+static int Matching(const u8* data, const u8* address, int length)
+{
+	int same = 0;
+	if(((size_t)data & 3) == 0)
+	{
+		const u32* a = (const u32*)data;
+		const u32* b = (const u32*)address;
+		for(; same < length; same += FLASHCART_WRITE_BLOCK_SIZE)
+		{
+			for(int i = 0; i < FLASHCART_WRITE_BLOCK_SIZE / 4; i++)
+			{
+				if(*a++ != *b++)
+				{
+					return same;
+				}
+			}
+		}
+	}
+	else
+	{
+		const u16* a = (const u16*)data;
+		const u16* b = (const u16*)address;
+		for(; same < length; same += FLASHCART_WRITE_BLOCK_SIZE)
+		{
+			for(int i = 0; i < FLASHCART_WRITE_BLOCK_SIZE / 2; i++)
+			{
+				if(*a++ != *b++)
+				{
+					return same;
+				}
+			}
+		}
+	}
+	return same;
+}
+
+// Compares source with what is on the cart at filePtr, while the block
+// hasn't been queued to be erased, and moves past what matches. A block
+// that matches all the way is neither erased nor programmed. Returns how
+// much of source matched.
+// Each block is copied from the cart when its comparing starts, as reading
+// the cart takes it back from the ARM7, which then has to finish everything
+// queued for it. The rest of the block is compared with the copy.
+int FlashCartFile::Compare(u8* source, int length)
+{
+	if(!delta || filePtr < erasePtr || erasePtr >= cartEnd)
+	{
+		return 0;
+	}
+
+	int compared = 0;
+	while(compared < length && erasePtr < cartEnd)
+	{
+		u8* blockEnd = erasePtr + FLASHCART_ERASE_BLOCK_SIZE;
+		if(copiedBlock != erasePtr)
+		{
+			FlashEngine::Suspend();
+			memcpy(savedBlock, erasePtr, FLASHCART_ERASE_BLOCK_SIZE);
+			FlashEngine::Resume();
+			copiedBlock = erasePtr;
+		}
+
+		int part = length - compared;
+		if(part > blockEnd - filePtr)
+		{
+			part = blockEnd - filePtr;
+		}
+		int same = Matching(source + compared, savedBlock + (filePtr - erasePtr), part);
+		if(verify == VERIFY_FULL)
+		{
+			fileCrc = Crc32(fileCrc, source + compared, same);
+		}
+		filePtr += same;
+		compared += same;
+		if(same < part)
+		{
+			break;
+		}
+		if(filePtr == blockEnd)
+		{
+			// nothing to verify either
+			erasePtr = blockStart = filePtr;
+			blockCrc = 0;
+			skipped++;
+			blocksSkipped.Increment();
+		}
+	}
+
+	if(compared < length)
+	{
+		Differ();
+	}
+	return compared;
+}
+
+// Keeps what matched of the block at erasePtr, in its copy, to be
+// programmed again before the rest once the block is erased.
+void FlashCartFile::Differ()
+{
+	savedPtr = savedBlock;
+	savedEnd = savedBlock + (filePtr - erasePtr);
+	filePtr = erasePtr;
+	EraseUpTo(filePtr + FLASHCART_ERASE_BLOCK_SIZE);
+
+	// what comes after a change is most likely new as well, so the rest is
+	// erased ahead as if nothing had been compared
+	delta = false;
+	EraseAhead();
+}
+
+// Programs up to length bytes of what was saved.
+void FlashCartFile::WriteSaved(int length)
+{
+	if(length > savedEnd - savedPtr)
+	{
+		length = savedEnd - savedPtr;
+	}
+	if(length == 0)
+	{
+		return;
+	}
+
+	u8* source = savedPtr;
+	savedPtr += length;
+	// it was added to fileCrc when it was compared
+	u32 crc = fileCrc;
+	Program(source, length);
+	fileCrc = crc;
+}
+
+// Throws if the ARM7 failed to program what was queued for it.
+void FlashCartFile::CheckProgrammed()
+{
+	u8* address;
+	bool verifying;
+	if(!FlashEngine::GetProgramFailure(&address, &verifying))
+	{
+		return;
+	}
+
+	static char e[1024];
+	if(verifying)
+	{
+		verifyFailures.Increment();
+		sprintf(e, "Verify failed at 0x%x", ADDRESS(address));
+	}
+	else
+	{
+		writeFailures.Increment();
+		sprintf(e, "Failed to write flash at 0x%x", ADDRESS(address));
+	}
+	throw e;
+}
+
+// Queues the blocks up to end that haven't been queued yet to be erased.
+void FlashCartFile::EraseUpTo(u8* end)
+{
+	if(end <= erasePtr)
+	{
+		return;
+	}
+
+	int blockCount = (end - erasePtr + FLASHCART_ERASE_BLOCK_SIZE_MASK) / FLASHCART_ERASE_BLOCK_SIZE;
+	if(erasePtr + blockCount * FLASHCART_ERASE_BLOCK_SIZE > cartEnd)
+	{
+		throw "Write outside flash cart.";
+	}
 
-	erasePtr += FLASHCART_ERASE_BLOCK_SIZE;
+	FlashEngine::Erase(erasePtr, blockCount);
+	erasePtr += blockCount * FLASHCART_ERASE_BLOCK_SIZE;
 }
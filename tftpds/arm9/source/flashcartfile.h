@@ -7,6 +7,15 @@
 #define FLASHCART_ERASE_BLOCK_SIZE_MASK 0x3FFFF
 #define FLASHCART_WRITE_BLOCK_SIZE 0x40
 #define FLASHCART_WRITE_BLOCK_SIZE_MASK 0x3F
+// unaligned data is copied through the buffer this much at a time
+#define FLASHCART_BUFFER_SIZE 0x200
+// how much is read back to be verified per Step
+#define FLASHCART_VERIFY_STEP 0x1000
+// VERIFY_SAMPLED reads back one in this many write blocks
+#define FLASHCART_VERIFY_SAMPLE 16
+// .ds.gba files start with a loader, followed by the .nds
+#define FLASHCART_LOADER_SIZE 0x200
+#define FLASHCART_NDS_ROM_SIZE 0x80   // in the .nds header
 
 class FlashCartFile : public File
 {
@@ -16,16 +25,68 @@ public:
 
 	virtual int Read(void* dest, int length);
 	virtual void Write(void* source, int length);
+	virtual int WriteDirect(void* source, int length);
+	virtual const void* Map(int length, int* mapped);
 	virtual void Close();
+	virtual void SetLength(int length);
+	virtual void SetVerify(VerifyPolicy policy);
+	virtual int GetLength();
+	virtual bool Step();
+
+	// Turns comparing blocks with what is written to them on or off, while
+	// nothing is being written.
+	static void UseDelta(bool use);
+	static bool IsUsingDelta();
 
 private:
 	void DetectFlashCart();
+	void DoClose(bool complete);
 	void DoWrite(u8* source, int length);
-	void EraseNextBlock();
+	void Program(u8* source, int length);
+	void CheckProgrammed();
+	void EraseUpTo(u8* end);
+	void EraseAhead();
+	void Track(u8* source, int length);
+	u32 Checksum(u32 crc, const u8* data, const u8* address, int length);
+	void QueueVerify(u8* end);
+	bool VerifyStep(int length);
+	void FinishVerify();
+	int Compare(u8* source, int length);
+	void Differ();
+	void WriteSaved(int length);
 
-	u8 buffer[FLASHCART_WRITE_BLOCK_SIZE];
+	u8 buffer[FLASHCART_BUFFER_SIZE];
 	int bufferFill;
+	u8* fileStart;
 	u8* filePtr;
 	u8* erasePtr;
+	u8* cartEnd;
+	u8* fileEnd;   // where reading stops
+	u8* writeEnd;  // where writing stops, if SetLength was told
+	bool locked;
 	FileState state;
+
+	// What is written is checked by reading it back in the background, an
+	// erase block at a time, and comparing its CRC to that of the data.
+	VerifyPolicy verify;
+	u8* blockStart;
+	u32 blockCrc;
+	u32 fileCrc;
+	bool fileTracked;
+	u8* verifyStart;
+	u8* verifyPtr;
+	u8* verifyEnd;
+	u32 verifyCrc;
+	u32 expectedCrc;
+
+	// With UseDelta, a block is only erased once what is written to it turns
+	// out to differ from what is already there. Until then the data is
+	// compared instead, with a copy of the block that is read from the cart
+	// in one go, and what matched is programmed again from it. The blocks
+	// after the first that differs are erased ahead like any others.
+	bool delta;
+	u8* copiedBlock; // the block at erasePtr, once it is copied
+	u8* savedPtr;
+	u8* savedEnd;
+	int skipped;
 };
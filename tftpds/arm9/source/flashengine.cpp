@@ -0,0 +1,447 @@
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include "flashengine.h"
+#include "flashcartfile.h"
+#include "cartlib.h"
+#include "clock.h"
+#include "metrics.h"
+
+static Counter blocksErased("cartlib_erase_blocks");
+static Counter eraseFailures("cartlib_erase_failures");
+static Counter eraseSuspends("cartlib_erase_suspends");
+static Histogram eraseTime("cartlib_erase_us");
+static Counter ringBytes("flashring_bytes");
+static Counter ringWaits("flashring_waits");
+static Counter handOvers("flashring_hand_overs");
+
+#define BLOCK(address) ((u8*)((size_t)(address) & ~FLASHCART_ERASE_BLOCK_SIZE_MASK))
+
+u8* FlashEngine::queue[FLASHENGINE_MAX_BLOCKS];
+int FlashEngine::first = 0;
+int FlashEngine::count = 0;
+bool FlashEngine::erasing = false;
+u32 FlashEngine::eraseStart = 0;
+int FlashEngine::suspended = 0;
+u8* FlashEngine::failed = NULL;
+int FlashEngine::locks = 0;
+FlashRing* FlashEngine::ring = NULL;
+bool FlashEngine::arm7 = false;
+bool FlashEngine::handedOver = false;
+int FlashEngine::held = 0;
+u32 FlashEngine::eraseHead = 0;
+u32 FlashEngine::erasesDone = 0;
+u32 FlashEngine::programHead = 0;
+u32 FlashEngine::programsDone = 0;
+u32 FlashEngine::dataHead = 0;
+u32 FlashEngine::dataTail = 0;
+u8* FlashEngine::programFailed = NULL;
+bool FlashEngine::verifyFailed = false;
+
+void FlashEngine::Erase(u8* address, int blockCount)
+{
+	for(int i = 0; i < blockCount; i++)
+	{
+		u8* block = BLOCK(address) + i * FLASHCART_ERASE_BLOCK_SIZE;
+		if(Find(block) != -1)
+		{
+			continue;
+		}
+
+		if(locks > 0)
+		{
+			// someone is reading, and would read the status instead
+			Finish();
+			u32 start = GetMicros();
+			int result = EraseTurboFABlocks(ADDRESS(block), 1);
+			eraseTime.Record(GetMicros() - start);
+			blocksErased.Increment();
+			if(!result)
+			{
+				eraseFailures.Increment();
+				failed = block;
+			}
+			continue;
+		}
+
+		if(count == FLASHENGINE_MAX_BLOCKS)
+		{
+			// can only happen if the same blocks are queued again
+			Finish();
+		}
+		if(HandOver())
+		{
+			ring->erases[eraseHead % FLASHRING_ERASES] = ADDRESS(block);
+			DC_FlushRange(&ring->erases[eraseHead % FLASHRING_ERASES], sizeof(u32));
+			eraseHead++;
+			ring->eraseHead = eraseHead;
+			DC_FlushRange((void*)&ring->eraseHead, sizeof(u32));
+		}
+		queue[(first + count) % FLASHENGINE_MAX_BLOCKS] = block;
+		count++;
+	}
+	Step();
+}
+
+bool FlashEngine::Step()
+{
+	if(handedOver)
+	{
+		return Receive();
+	}
+	if(suspended > 0)
+	{
+		return false;
+	}
+	if(erasing)
+	{
+		return Poll();
+	}
+	if(count == 0)
+	{
+		return false;
+	}
+
+	eraseStart = GetMicros();
+	erasing = StartTurboFAErase(ADDRESS(queue[first]));
+	if(!erasing)
+	{
+		printf("Failed to start erasing at 0x%x\n", ADDRESS(queue[first]));
+		eraseFailures.Increment();
+		failed = queue[first];
+		first = (first + 1) % FLASHENGINE_MAX_BLOCKS;
+		count--;
+	}
+	return true;
+}
+
+// Finishes the erase in progress if it is done.
+bool FlashEngine::Poll()
+{
+	u32 result = PollTurboFAErase();
+	if(result == 0)
+	{
+		return false;
+	}
+
+	eraseTime.Record(GetMicros() - eraseStart);
+	blocksErased.Increment();
+	if(result != 1)
+	{
+		eraseFailures.Increment();
+		failed = queue[first];
+	}
+	erasing = false;
+	first = (first + 1) % FLASHENGINE_MAX_BLOCKS;
+	count--;
+	return true;
+}
+
+int FlashEngine::Find(u8* block)
+{
+	for(int i = 0; i < count; i++)
+	{
+		int index = (first + i) % FLASHENGINE_MAX_BLOCKS;
+		if(queue[index] == block)
+		{
+			return index;
+		}
+	}
+	return -1;
+}
+
+bool FlashEngine::IsErased(u8* address, u8* end)
+{
+	if(failed != NULL && failed >= BLOCK(address) && failed < end)
+	{
+		u8* block = failed;
+		failed = NULL;
+		static char e[1024];
+		sprintf(e, "Failed to erase flash at 0x%x", ADDRESS(block));
+		throw e;
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		u8* block = queue[(first + i) % FLASHENGINE_MAX_BLOCKS];
+		if(block + FLASHCART_ERASE_BLOCK_SIZE > address && block < end)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void FlashEngine::WaitErased(u8* address, u8* end)
+{
+	while(!IsErased(address, end))
+	{
+		Step();
+	}
+}
+
+void FlashEngine::Finish()
+{
+	if(handedOver)
+	{
+		Reclaim();
+	}
+	while(count > 0)
+	{
+		Step();
+	}
+}
+
+void FlashEngine::Suspend()
+{
+	Acquire();
+	suspended++;
+	if(suspended > 1 || !erasing)
+	{
+		return;
+	}
+
+	if(SuspendTurboFAErase())
+	{
+		eraseSuspends.Increment();
+	}
+	else
+	{
+		// it had just finished
+		Poll();
+	}
+}
+
+void FlashEngine::Resume()
+{
+	suspended--;
+	if(suspended == 0 && erasing)
+	{
+		ResumeTurboFAErase();
+	}
+	Release();
+}
+
+void FlashEngine::Lock()
+{
+	Finish();
+	locks++;
+}
+
+void FlashEngine::Unlock()
+{
+	locks--;
+}
+
+void FlashEngine::Acquire()
+{
+	held++;
+	if(handedOver)
+	{
+		Reclaim();
+	}
+}
+
+void FlashEngine::Release()
+{
+	held--;
+}
+
+void FlashEngine::UseArm7(bool use)
+{
+	if(!use)
+	{
+		Finish();
+	}
+	else if(ring == NULL)
+	{
+		ring = new FlashRing;
+		memset(ring, 0, sizeof(FlashRing));
+		DC_FlushRange(ring, sizeof(FlashRing));
+		while(!FlashRingSend(ADDRESS(ring)))
+		{
+		}
+	}
+	arm7 = use;
+}
+
+bool FlashEngine::IsUsingArm7()
+{
+	return arm7;
+}
+
+bool FlashEngine::IsHandedOver()
+{
+	return handedOver;
+}
+
+// Hands the cart over to the ARM7, if it isn't already and the ARM9
+// neither needs it nor has anything left to erase itself.
+bool FlashEngine::HandOver()
+{
+	if(handedOver)
+	{
+		return true;
+	}
+	if(!arm7 || held > 0 || locks > 0 || erasing || count > 0)
+	{
+		return false;
+	}
+
+	REG_EXMEMCNT |= 0x80;
+	handedOver = true;
+	handOvers.Increment();
+	return true;
+}
+
+void FlashEngine::Reclaim()
+{
+	while(erasesDone != eraseHead || programsDone != programHead)
+	{
+		Receive();
+	}
+	REG_EXMEMCNT &= ~0x80;
+	handedOver = false;
+}
+
+// Takes in what the ARM7 has sent. Returns true if there was anything.
+bool FlashEngine::Receive()
+{
+	bool received = false;
+	u32 message;
+	while(FlashRingReceive(&message))
+	{
+		received = true;
+		u32 value = message & FLASHRING_MSG_VALUE;
+		switch(message & FLASHRING_MSG_TYPE)
+		{
+		case FLASHRING_MSG_ERASED:
+		{
+			// the counts only have 28 bits
+			int done = (value - erasesDone) & FLASHRING_MSG_VALUE;
+			erasesDone += done;
+			first = (first + done) % FLASHENGINE_MAX_BLOCKS;
+			count -= done;
+			blocksErased.Add(done);
+			break;
+		}
+		case FLASHRING_MSG_PROGRAMMED:
+		{
+			programsDone += (value - programsDone) & FLASHRING_MSG_VALUE;
+			FlashRingProgram* program = &ring->programs[(programsDone - 1) % FLASHRING_PROGRAMS];
+			dataTail = program->position + program->length;
+			break;
+		}
+		case FLASHRING_MSG_ERASE_FAILED:
+			eraseFailures.Increment();
+			failed = CART_BASE + value;
+			break;
+		case FLASHRING_MSG_WRITE_FAILED:
+		case FLASHRING_MSG_VERIFY_FAILED:
+			if(programFailed == NULL)
+			{
+				programFailed = CART_BASE + value;
+				verifyFailed = (message & FLASHRING_MSG_TYPE) == FLASHRING_MSG_VERIFY_FAILED;
+			}
+			break;
+		}
+	}
+	return received;
+}
+
+// Returns true if a program of length bytes fits in the ring now, and the
+// position of its data, which never wraps around the end.
+bool FlashEngine::HasRoom(int length, u32* position)
+{
+	*position = dataHead;
+	if(dataHead % FLASHRING_DATA_SIZE + length > FLASHRING_DATA_SIZE)
+	{
+		*position += FLASHRING_DATA_SIZE - dataHead % FLASHRING_DATA_SIZE;
+	}
+	return programHead - programsDone < FLASHRING_PROGRAMS &&
+		*position + length - dataTail <= FLASHRING_DATA_SIZE;
+}
+
+bool FlashEngine::Program(u8* source, u8* address, int length, bool verify)
+{
+	if(!HandOver())
+	{
+		return false;
+	}
+	// throws if erasing it failed
+	IsErased(address, address + length);
+
+	while(length > 0)
+	{
+		int chunk = length < FLASHRING_MAX_PROGRAM ? length : FLASHRING_MAX_PROGRAM;
+		u32 position;
+		if(!HasRoom(chunk, &position))
+		{
+			ringWaits.Increment();
+			while(!HasRoom(chunk, &position))
+			{
+				Receive();
+			}
+		}
+
+		u8* data = ring->data + position % FLASHRING_DATA_SIZE;
+		memcpy(data, source, chunk);
+		DC_FlushRange(data, chunk);
+		FlashRingProgram* program = &ring->programs[programHead % FLASHRING_PROGRAMS];
+		program->address = ADDRESS(address);
+		program->length = chunk;
+		program->position = position;
+		program->verify = verify;
+		DC_FlushRange(program, sizeof(FlashRingProgram));
+		programHead++;
+		ring->programHead = programHead;
+		DC_FlushRange((void*)&ring->programHead, sizeof(u32));
+
+		dataHead = position + chunk;
+		ringBytes.Add(chunk);
+		source += chunk;
+		address += chunk;
+		length -= chunk;
+	}
+	return true;
+}
+
+int FlashEngine::GetRoom()
+{
+	Receive();
+	if(programHead - programsDone == FLASHRING_PROGRAMS)
+	{
+		return 0;
+	}
+
+	// up to the end of the ring, or from its start
+	int free = FLASHRING_DATA_SIZE - (dataHead - dataTail);
+	int toEnd = FLASHRING_DATA_SIZE - dataHead % FLASHRING_DATA_SIZE;
+	int room = free <= toEnd ? free : free - toEnd;
+	if(free > toEnd && toEnd > room)
+	{
+		room = toEnd;
+	}
+	return room < FLASHRING_MAX_PROGRAM ? room : FLASHRING_MAX_PROGRAM;
+}
+
+void FlashEngine::Flush()
+{
+	while(handedOver && programsDone != programHead)
+	{
+		Receive();
+	}
+}
+
+bool FlashEngine::GetProgramFailure(u8** address, bool* verifying)
+{
+	Receive();
+	if(programFailed == NULL)
+	{
+		return false;
+	}
+	*address = programFailed;
+	*verifying = verifyFailed;
+	programFailed = NULL;
+	return true;
+}
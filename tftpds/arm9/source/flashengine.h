@@ -0,0 +1,93 @@
+#pragma once
+
+#include "platform.h"
+#include "flashring.h"
+
+// a whole Turbo FA 256M
+#define FLASHENGINE_MAX_BLOCKS 128
+
+// Erases flash cart blocks in the background. A block takes about a second
+// to erase, during which the cart can't be read, so instead of waiting for
+// it, blocks are queued and Step starts and finishes them one at a time
+// from the main loop. Programming and reading in between is done by
+// suspending the erase in progress. While the cart is locked for reading,
+// blocks are erased right away instead.
+//
+// With UseArm7, the cart is handed over to the ARM7 whenever nothing else
+// needs it, and the erases and programs are queued for it in a FlashRing,
+// so that the ARM9 only has to copy the data. Taking the cart back waits
+// for everything that is queued.
+class FlashEngine
+{
+public:
+	// Queues the blockCount blocks from address to be erased.
+	static void Erase(u8* address, int blockCount);
+	// Notices when the block being erased is done, and starts erasing the
+	// next one. Returns true if anything happened.
+	static bool Step();
+	// Returns true if nothing from address up to end is waiting to be
+	// erased. Throws if erasing any of it failed.
+	static bool IsErased(u8* address, u8* end);
+	// Waits until IsErased.
+	static void WaitErased(u8* address, u8* end);
+	// Waits until everything that is queued is erased.
+	static void Finish();
+
+	// Between Suspend and Resume the cart can be read and programmed,
+	// except for the block being erased.
+	static void Suspend();
+	static void Resume();
+
+	static void Lock();
+	static void Unlock();
+
+	// Between Acquire and Release the ARM9 has the cart, and the sram.
+	static void Acquire();
+	static void Release();
+
+	static void UseArm7(bool use);
+	static bool IsUsingArm7();
+	// Returns true if the cart is the ARM7's, so that Program queues for it.
+	static bool IsHandedOver();
+	// Queues length bytes from source to be programmed at address, and
+	// compared if verify is true, waiting for room in the ring if needed.
+	// Returns false, and does nothing, if the cart can't be handed over to
+	// the ARM7.
+	static bool Program(u8* source, u8* address, int length, bool verify);
+	// Returns how much Program can take without waiting.
+	static int GetRoom();
+	// Waits until everything queued is programmed and verified.
+	static void Flush();
+	// Returns true, once, if programming failed, and where.
+	static bool GetProgramFailure(u8** address, bool* verifying);
+
+private:
+	static bool Poll();
+	static int Find(u8* block);
+	static bool HandOver();
+	static void Reclaim();
+	static bool Receive();
+	static bool HasRoom(int length, u32* position);
+
+	static u8* queue[FLASHENGINE_MAX_BLOCKS];
+	static int first;
+	static int count;
+	static bool erasing;
+	static u32 eraseStart;
+	static int suspended;
+	static u8* failed;
+	static int locks;
+
+	static FlashRing* ring;
+	static bool arm7;
+	static bool handedOver;
+	static int held;
+	static u32 eraseHead;
+	static u32 erasesDone;
+	static u32 programHead;
+	static u32 programsDone;
+	static u32 dataHead;
+	static u32 dataTail;
+	static u8* programFailed;
+	static bool verifyFailed;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+// The ring in main RAM through which the ARM9 has the ARM7 erase and program
+// the flash cart, while the ARM9 gets on with the network. Only the ARM9
+// writes to it, and only the ARM7 reads it: the ARM9 fills in an entry and
+// its data, and then moves the head past it. The ARM7 erases the blocks in
+// the order they were queued, and programs and verifies the data in order,
+// suspending the erase in progress to program blocks that are already
+// erased. How far it has got is sent back over the IPC FIFO, as the number
+// of erases and programs done so far, since the ARM9 has the ring cached.
+#include "platform.h"
+
+#define FLASHRING_ERASES 128       // a whole Turbo FA 256M
+#define FLASHRING_PROGRAMS 64
+#define FLASHRING_DATA_SIZE 0x8000
+// a program is at most this long, so that the data never has to wrap
+#define FLASHRING_MAX_PROGRAM 0x1000
+
+// The words sent over the IPC FIFO. The ARM9 sends the address of the ring
+// once, and the ARM7 sends messages, each a type and a 28 bit value.
+#define FLASHRING_MSG_TYPE 0xF0000000
+#define FLASHRING_MSG_VALUE 0x0FFFFFFF
+#define FLASHRING_MSG_ERASED 0x10000000        // erases done
+#define FLASHRING_MSG_PROGRAMMED 0x20000000    // programs done
+// the offset into the cart where it failed, after which the ARM7 skips
+// the programs that are queued, which are the rest of the same file
+#define FLASHRING_MSG_ERASE_FAILED 0x30000000
+#define FLASHRING_MSG_WRITE_FAILED 0x40000000
+#define FLASHRING_MSG_VERIFY_FAILED 0x50000000
+
+typedef struct
+{
+	u32 address;    // in the cart
+	u32 length;     // a multiple of 64
+	u32 position;   // of the data, counted from the start of the ring
+	u32 verify;     // non-zero to compare it with the data once programmed
+} FlashRingProgram;
+
+typedef struct
+{
+	// counted from when the ring was made, and never reset, so that the
+	// ARM7 never has to be told to start over
+	vu32 eraseHead;
+	vu32 programHead;
+
+	u32 erases[FLASHRING_ERASES];   // the address of each block
+	FlashRingProgram programs[FLASHRING_PROGRAMS];
+	u8 data[FLASHRING_DATA_SIZE];
+} FlashRing;
+
+// FlashRingSend sends a word to the other cpu, if there is room in the
+// FIFO, and returns non-zero if it was sent. FlashRingReceive returns
+// non-zero, and the word in *message, if one has been sent.
+#ifdef DS
+static inline int FlashRingSend(u32 message)
+{
+	if(REG_IPC_FIFO_CR & IPC_FIFO_SEND_FULL)
+	{
+		return 0;
+	}
+	REG_IPC_FIFO_TX = message;
+	return 1;
+}
+
+static inline int FlashRingReceive(u32* message)
+{
+	if(REG_IPC_FIFO_CR & IPC_FIFO_RECV_EMPTY)
+	{
+		return 0;
+	}
+	*message = REG_IPC_FIFO_RX;
+	return 1;
+}
+#else
+// the host build runs the ARM7 as a thread, see host/hostipc.c
+#ifdef __cplusplus
+extern "C" {
+#endif
+int FlashRingSend(u32 message);
+int FlashRingReceive(u32* message);
+#ifdef __cplusplus
+}
+#endif
+#endif
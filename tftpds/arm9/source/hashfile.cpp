@@ -0,0 +1,135 @@
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include "hashfile.h"
+#include "crc.h"
+
+HashFile::HashFile(const char* filename, bool write)
+:	cart(filename, false),
+	start(NULL),
+	blockCount(0),
+	blocksHashed(0),
+	hashPtr(NULL),
+	crc(0),
+	line(0),
+	textPos(HASHFILE_LINE_LENGTH),
+	state(FILESTATE_READ)
+{
+	if(write)
+	{
+		throw "Hashes are read only.";
+	}
+
+	// as far as the cart file would be read, up to the end of its block
+	int size;
+	start = hashPtr = (const u8*)cart.Map(cart.GetLength(), &size);
+	blockCount = (size + FLASHCART_ERASE_BLOCK_SIZE_MASK) / FLASHCART_ERASE_BLOCK_SIZE;
+	if(blockCount > HASHFILE_MAX_BLOCKS)
+	{
+		blockCount = HASHFILE_MAX_BLOCKS;
+	}
+}
+
+HashFile::~HashFile()
+{
+}
+
+int HashFile::Read(void* dest, int length)
+{
+	if(state != FILESTATE_READ)
+	{
+		throw "Illegal state.";
+	}
+
+	// Step hashes a little at a time, so that the scheduler isn't held up
+	// for all of the blocks that a window of lines covers
+	int position = line * HASHFILE_LINE_LENGTH - (HASHFILE_LINE_LENGTH - textPos);
+	int lastLine = (position + length - 1) / HASHFILE_LINE_LENGTH;
+	if(lastLine >= blockCount)
+	{
+		lastLine = blockCount - 1;
+	}
+	if(blocksHashed <= lastLine)
+	{
+		return -1;
+	}
+
+	char* writePtr = (char*)dest;
+	while(length > 0)
+	{
+		if(textPos == HASHFILE_LINE_LENGTH)
+		{
+			if(line == blockCount)
+			{
+				break;
+			}
+			sprintf(text, "%07x %08x\n",
+				ADDRESS(start) - ADDRESS(CART_BASE) + line * FLASHCART_ERASE_BLOCK_SIZE,
+				crcs[line]);
+			line++;
+			textPos = 0;
+		}
+
+		int count = HASHFILE_LINE_LENGTH - textPos;
+		if(count > length)
+		{
+			count = length;
+		}
+		memcpy(writePtr, text + textPos, count);
+		writePtr += count;
+		textPos += count;
+		length -= count;
+	}
+
+	return writePtr - (char*)dest;
+}
+
+void HashFile::Write(void* source, int length)
+{
+	throw "Hashes are read only.";
+}
+
+void HashFile::Close()
+{
+	if(state != FILESTATE_CLOSED)
+	{
+		cart.Close();
+		state = FILESTATE_CLOSED;
+	}
+}
+
+int HashFile::GetLength()
+{
+	return blockCount * HASHFILE_LINE_LENGTH;
+}
+
+// Hashes the blocks ahead of the lines that have been read, between the
+// packets, and the ones that Read waits for.
+bool HashFile::Step()
+{
+	return state == FILESTATE_READ && HashStep(FLASHCART_VERIFY_STEP);
+}
+
+// Adds up to length bytes of the next block to its CRC. Returns true if
+// there was anything left to hash.
+bool HashFile::HashStep(int length)
+{
+	if(blocksHashed == blockCount)
+	{
+		return false;
+	}
+
+	const u8* blockEnd = start + (blocksHashed + 1) * FLASHCART_ERASE_BLOCK_SIZE;
+	if(length > blockEnd - hashPtr)
+	{
+		length = blockEnd - hashPtr;
+	}
+	crc = Crc32(crc, hashPtr, length);
+	hashPtr += length;
+	if(hashPtr == blockEnd)
+	{
+		crcs[blocksHashed++] = crc;
+		crc = 0;
+	}
+	return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "file.h"
+#include "flashcartfile.h"
+
+// a whole Turbo FA 256M
+#define HASHFILE_MAX_BLOCKS 128
+// "<offset> <crc>\n", both in hex
+#define HASHFILE_LINE_LENGTH 17
+
+// The CRC-32 of each erase block of the cart from an offset, as a read only
+// text file with a line per block, so that a client can tell which blocks
+// of a file it has to send again. They cover as much as reading the cart
+// file at the offset would, e.g. /rom/100000/hashes/80000 for 512 kb. The
+// CRCs are worked out in the background while the lines before them are
+// sent, and reading the lines of blocks that aren't done yet waits.
+class HashFile : public File
+{
+public:
+	HashFile(const char* filename, bool write);
+	virtual ~HashFile();
+
+	virtual int Read(void* dest, int length);
+	virtual void Write(void* source, int length);
+	virtual void Close();
+	virtual int GetLength();
+	virtual bool Step();
+
+private:
+	bool HashStep(int length);
+
+	FlashCartFile cart;
+	const u8* start;
+	int blockCount;
+	int blocksHashed;
+	const u8* hashPtr;
+	u32 crc;
+	u32 crcs[HASHFILE_MAX_BLOCKS];
+	int line;
+	char text[HASHFILE_LINE_LENGTH + 1];
+	int textPos;
+	FileState state;
+};
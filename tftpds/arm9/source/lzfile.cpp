@@ -0,0 +1,248 @@
+#include "platform.h"
+#include <stdio.h>
+#include "lzfile.h"
+#include "metrics.h"
+
+static Counter bytesCompressed("lz_bytes_compressed");
+static Counter bytesDecompressed("lz_bytes_decompressed");
+
+static u8 window[LZFILE_WINDOW_SIZE];
+static LzFile* windowOwner = NULL;
+
+LzFile::LzFile(const char* filename, bool write)
+:	cart(filename, write),
+	headerLength(0),
+	header(0),
+	outputLength(0),
+	produced(0),
+	flushed(0),
+	consumed(0),
+	flags(0),
+	flagBits(0),
+	tokenByte(-1),
+	copyLeft(0),
+	copyDistance(0),
+	state(FILESTATE_WRITE)
+{
+	if(!write)
+	{
+		throw "Compressed files can only be written.";
+	}
+	if(windowOwner != NULL)
+	{
+		throw "Only one compressed file at a time.";
+	}
+	windowOwner = this;
+}
+
+// A transfer that didn't finish is given up on by the cart.
+LzFile::~LzFile()
+{
+	if(windowOwner == this)
+	{
+		windowOwner = NULL;
+	}
+}
+
+int LzFile::Read(void* dest, int length)
+{
+	throw "Illegal state.";
+}
+
+void LzFile::Write(void* source, int length)
+{
+	if(state != FILESTATE_WRITE)
+	{
+		throw "Illegal state.";
+	}
+
+	const u8* data = (const u8*)source;
+	while(length > 0)
+	{
+		Flush(true);
+		int used = Decompress(data, length);
+		data += used;
+		length -= used;
+	}
+}
+
+// Decompresses as much as fits in the window, once what was in it is on
+// the cart.
+int LzFile::WriteDirect(void* source, int length)
+{
+	if(state != FILESTATE_WRITE)
+	{
+		throw "Illegal state.";
+	}
+
+	// once it is all decompressed, the end of it is written by Close
+	if(!Flush(false) && produced != outputLength)
+	{
+		return 0;
+	}
+	return Decompress((const u8*)source, length);
+}
+
+void LzFile::Close()
+{
+	FileState closing = state;
+	state = FILESTATE_CLOSED;
+	if(windowOwner == this)
+	{
+		windowOwner = NULL;
+	}
+
+	if(closing == FILESTATE_WRITE)
+	{
+		// the last reference may have been cut off at the end of the
+		// window after the last of the input was used
+		while(copyLeft > 0)
+		{
+			Flush(true);
+			Decompress(NULL, 0);
+		}
+		if(produced != outputLength || headerLength < 4)
+		{
+			// left for the cart to give up on
+			throw "Compressed file ended early.";
+		}
+		Flush(true);
+		printf("%u bytes decompressed from %u\n", (unsigned int)produced, (unsigned int)consumed);
+	}
+	cart.Close();
+}
+
+void LzFile::SetVerify(VerifyPolicy policy)
+{
+	cart.SetVerify(policy);
+}
+
+bool LzFile::Step()
+{
+	return cart.Step();
+}
+
+// Decompresses from source until the window is full of what hasn't been
+// written yet. Returns how much of source was used.
+int LzFile::Decompress(const u8* source, int length)
+{
+	const u8* data = source;
+	const u8* end = source + length;
+	while(produced - flushed < LZFILE_WINDOW_SIZE)
+	{
+		if(copyLeft > 0)
+		{
+			window[produced & LZFILE_WINDOW_MASK] = window[(produced - copyDistance) & LZFILE_WINDOW_MASK];
+			produced++;
+			copyLeft--;
+			continue;
+		}
+		if(produced == outputLength && headerLength == 4)
+		{
+			// the rest is padding
+			data = end;
+			break;
+		}
+		if(data == end)
+		{
+			break;
+		}
+
+		if(headerLength < 4)
+		{
+			header |= *data++ << (headerLength * 8);
+			headerLength++;
+			if(headerLength == 4)
+			{
+				outputLength = header >> 8;
+				if((header & 0xFF) != 0x10 || outputLength == 0)
+				{
+					throw "Not LZ77 compressed.";
+				}
+				cart.SetLength(outputLength);
+			}
+		}
+		else if(flagBits == 0)
+		{
+			flags = *data++;
+			flagBits = 8;
+		}
+		else if((flags & 0x80) == 0)
+		{
+			window[produced & LZFILE_WINDOW_MASK] = *data++;
+			produced++;
+			flags <<= 1;
+			flagBits--;
+		}
+		else if(tokenByte == -1)
+		{
+			tokenByte = *data++;
+		}
+		else
+		{
+			// 4 bits of length and 12 of how far back
+			copyLeft = (tokenByte >> 4) + 3;
+			copyDistance = (((tokenByte & 0xF) << 8) | *data++) + 1;
+			tokenByte = -1;
+			flags <<= 1;
+			flagBits--;
+			if(copyDistance > produced)
+			{
+				throw "Corrupt compressed file.";
+			}
+			if(copyLeft > (int)(outputLength - produced))
+			{
+				copyLeft = outputLength - produced;
+			}
+		}
+	}
+
+	consumed += data - source;
+	bytesCompressed.Add(data - source);
+	return data - source;
+}
+
+// Writes the window to the cart once it is full, or what there is of it
+// once everything is decompressed. Returns true if it is written, which it
+// always is if wait is true.
+bool LzFile::Flush(bool wait)
+{
+	// a window that was only partly written is finished before anything
+	// more is decompressed into it
+	bool full = (produced - flushed == LZFILE_WINDOW_SIZE);
+	bool partial = ((flushed & LZFILE_WINDOW_MASK) != 0);
+	if(produced == flushed || (!full && !partial && produced != outputLength))
+	{
+		return true;
+	}
+
+	while(produced != flushed)
+	{
+		// never past the end of the window
+		u8* source = window + (flushed & LZFILE_WINDOW_MASK);
+		int length = produced - flushed;
+		int room = LZFILE_WINDOW_SIZE - (flushed & LZFILE_WINDOW_MASK);
+		if(length > room)
+		{
+			length = room;
+		}
+
+		int written;
+		if(wait)
+		{
+			cart.Write(source, length);
+			written = length;
+		}
+		else
+		{
+			written = cart.WriteDirect(source, length);
+		}
+		flushed += written;
+		bytesDecompressed.Add(written);
+		if(written < length)
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "file.h"
+#include "flashcartfile.h"
+
+// as far back as LZ77 can refer
+#define LZFILE_WINDOW_SIZE 0x1000
+#define LZFILE_WINDOW_MASK 0xFFF
+
+// Writes a file compressed with the LZ77 of the GBA and DS BIOS (type
+// 0x10) to the flash cart, decompressing it as it is received. The
+// decompressed data goes to the cart a window at a time, which it is kept
+// in until then, since what comes after it refers back to it. The window is
+// shared, so only one file at a time can be decompressed.
+class LzFile : public File
+{
+public:
+	LzFile(const char* filename, bool write);
+	virtual ~LzFile();
+
+	virtual int Read(void* dest, int length);
+	virtual void Write(void* source, int length);
+	virtual int WriteDirect(void* source, int length);
+	virtual void Close();
+	virtual void SetVerify(VerifyPolicy policy);
+	virtual bool Step();
+
+private:
+	int Decompress(const u8* source, int length);
+	bool Flush(bool wait);
+
+	FlashCartFile cart;
+	int headerLength;
+	u32 header;
+	u32 outputLength;
+	u32 produced;
+	u32 flushed;
+	u32 consumed;
+	u8 flags;
+	int flagBits;
+	int tokenByte;
+	int copyLeft;
+	u32 copyDistance;
+	FileState state;
+};
@@ -18,8 +18,15 @@
 #include <driver.h>
 
 #include "tftpserver.h"
+#include "transferhud.h"
+#include "scheduler.h"
+#include "clock.h"
 #include "cartlib.h"
 #include "bootdialog.h"
+#include "networkheap.h"
+#include "packettrace.h"
+#include "flashengine.h"
+#include "flashcartfile.h"
 
 
 BootDialog* dialog = NULL;
@@ -28,12 +35,12 @@ BootDialog* dialog = NULL;
 extern "C" {
 	void * sgIP_malloc(int size)
 	{
-		return malloc(size);
+		return NetworkAlloc(size);
 	}
 
 	void sgIP_free(void *ptr)
 	{
-		free(ptr);
+		NetworkFree(ptr);
 	}
 
 	void sgIP_dbgprint(char *txt, ...)
@@ -62,24 +69,6 @@ extern "C" {
 }
 
 
-// function used by our own server for timeouts
-void ResetTimer()
-{
-	// make a 1 Hz timer
-	TIMER0_CR = 0;
-	TIMER1_CR = 0;
-	TIMER0_DATA = 0xffff - 0x7fff;
-	TIMER1_DATA = 0;
-	TIMER0_CR = TIMER_DIV_1024;
-	TIMER1_CR = TIMER_CASCADE;
-}
-
-// function used by our own server for timeouts
-int GetTimer()
-{
-	return TIMER1_DATA;
-}
-
 void SetupWifi()
 {
 	// send fifo message to initialize the arm7 wifi
@@ -184,9 +173,33 @@ void WaitForKeyPress()
 	while(keysDown() == 0);
 }
 
-void TcpTest()
+// Measures how fast we can receive over TCP. Listens on port 80 and counts
+// the bytes from the first client until it disconnects.
+class TcpTestTask : public Task
+{
+public:
+	TcpTestTask() : sock(-1), sock2(-1), start(0), recieved(0) {}
+
+	void Start();
+	virtual bool Step();
+
+private:
+	void Stop();
+
+	int sock;
+	int sock2;
+	u32 start;
+	unsigned int recieved;
+};
+
+void TcpTestTask::Start()
 {
-	int sock = socket(PF_INET, SOCK_STREAM, 0);
+	if(sock != -1)
+	{
+		return;
+	}
+
+	sock = socket(PF_INET, SOCK_STREAM, 0);
 	if(sock == -1)
 	{
 		printf("socket() failed\n");
@@ -201,6 +214,7 @@ void TcpTest()
 	if(result == -1)
 	{
 		printf("bind() failed\n");
+		Stop();
 		return;
 	}
 
@@ -208,65 +222,123 @@ void TcpTest()
 	if(result == -1)
 	{
 		printf("listen() failed\n");
+		Stop();
 		return;
 	}
 
+	// set socket to non-blocking, so we can wait for the client in Step
+	int i = 1;
+	ioctl(sock, FIONBIO, &i);
+
 	printf("TcpTest Listening...\n");
+}
 
-	int len = sizeof(sain);
-	int sock2 = accept(sock, (struct sockaddr *)&sain, &len);
-	if(sock2 == -1)
+bool TcpTestTask::Step()
+{
+	if(sock == -1)
 	{
-		printf("accept() failed\n");
-		return;
+		return false;
 	}
 
-	printf("accepted %lu.%lu.%lu.%lu\n",
-		(sain.sin_addr.s_addr >>  0) & 0xFF,
-		(sain.sin_addr.s_addr >>  8) & 0xFF,
-		(sain.sin_addr.s_addr >> 16) & 0xFF,
-		(sain.sin_addr.s_addr >> 24) & 0xFF);
+	if(sock2 == -1)
+	{
+		struct sockaddr_in sain;
+		int len = sizeof(sain);
+		sock2 = accept(sock, (struct sockaddr *)&sain, &len);
+		if(sock2 == -1)
+		{
+			if(errno != EAGAIN)
+			{
+				printf("accept() failed\n");
+				Stop();
+			}
+			return false;
+		}
+
+		printf("accepted %lu.%lu.%lu.%lu\n",
+			(sain.sin_addr.s_addr >>  0) & 0xFF,
+			(sain.sin_addr.s_addr >>  8) & 0xFF,
+			(sain.sin_addr.s_addr >> 16) & 0xFF,
+			(sain.sin_addr.s_addr >> 24) & 0xFF);
 
-	// set socket to non-blocking
-	//int i = 1;
-	//ioctl(sock, FIONBIO, &i);
+		int i = 1;
+		ioctl(sock2, FIONBIO, &i);
 
-	printf("received \e[s         0 bytes");
+		printf("received \e[s         0 bytes");
+		start = GetMillis();
+		recieved = 0;
+		return true;
+	}
 
-	ResetTimer();
 	char buffer[10240];
-	unsigned int recieved = 0;
-	int length;
-	while((length = recv(sock2, buffer, sizeof(buffer), 0)) != 0)
+	int length = recv(sock2, buffer, sizeof(buffer), 0);
+	if(length == -1 && errno == EAGAIN)
 	{
-		if(length == -1 && errno != EAGAIN)
-		{
-			break;
-		}
-		else
-		{
-			recieved += length;
-			printf("\e[u\e[0K%10u", recieved);
-		}
+		return false;
+	}
+	if(length > 0)
+	{
+		recieved += length;
+		printf("\e[u\e[0K%10u", recieved);
+		return true;
 	}
 
-	int elapsed = GetTimer();
-	printf("\nelapsed %i s\n", elapsed);
-	printf("%f kb/s\n", recieved/(double)elapsed/1024.0);
+	u32 elapsed = GetMillis() - start;
+	printf("\nelapsed %u ms\n", elapsed);
+	printf("%f kb/s\n", recieved/(double)elapsed*1000.0/1024.0);
 
-	closesocket(sock2);
-	closesocket(sock);
+	Stop();
+	return false;
 }
 
-void TcpSendTest()
+void TcpTestTask::Stop()
 {
-	int sock = socket(PF_INET, SOCK_STREAM, 0);
+	if(sock2 != -1)
+	{
+		closesocket(sock2);
+		sock2 = -1;
+	}
+	if(sock != -1)
+	{
+		closesocket(sock);
+		sock = -1;
+	}
+}
+
+// Measures how fast we can send over TCP, by sending 200 kb to port 4000
+// on 192.168.0.1.
+class TcpSendTestTask : public Task
+{
+public:
+	TcpSendTestTask() : sock(-1), start(0), sent(0) {}
+
+	void Start();
+	virtual bool Step();
+
+private:
+	void Stop();
+
+	int sock;
+	u32 start;
+	unsigned int sent;
+	char buffer[10240];
+};
+
+void TcpSendTestTask::Start()
+{
+	if(sock != -1)
+	{
+		return;
+	}
+
+	sock = socket(PF_INET, SOCK_STREAM, 0);
 	if(sock == -1)
 	{
 		printf("socket() failed\n");
 		return;
 	}
 
+	// connecting blocks, but only for a round trip on the local network
 	struct sockaddr_in sain;
 	sain.sin_family = AF_INET;
 	sain.sin_port = htons(4000);
@@ -275,40 +347,226 @@ void TcpSendTest()
 	if(result == -1)
 	{
 		printf("connect() failed\n");
+		Stop();
 		return;
 	}
 
 	// set socket to non-blocking
-	int i = 0;
+	int i = 1;
 	ioctl(sock, FIONBIO, &i);
 
 	printf("sent \e[s         0 bytes");
+	start = GetMillis();
+	sent = 0;
+}
 
-	ResetTimer();
-	char buffer[10240];
-	unsigned int sent = 0;
-	do {
-		int length = send(sock, buffer, sizeof(buffer), 0);
-		if(length == -1)
+bool TcpSendTestTask::Step()
+{
+	if(sock == -1)
+	{
+		return false;
+	}
+
+	int length = send(sock, buffer, sizeof(buffer), 0);
+	if(length == -1)
+	{
+		if(errno != EAGAIN)
 		{
-			if(errno == EAGAIN)
-			{
-				continue;
-			}
-			//printf("send() failed\n");
 			perror("send");
-			return;
+			Stop();
 		}
+		return false;
+	}
 
-		sent += length;
-		printf("\e[u\e[0K%10u", sent);
-	} while (sent < 200*1024);
+	sent += length;
+	printf("\e[u\e[0K%10u", sent);
+	if(sent < 200*1024)
+	{
+		return true;
+	}
 
-	int elapsed = GetTimer();
-	printf("\nelapsed %i s\n", elapsed);
-	printf("%f kb/s\n", sent/(double)elapsed/1024.0);
+	u32 elapsed = GetMillis() - start;
+	printf("\nelapsed %u ms\n", elapsed);
+	printf("%f kb/s\n", sent/(double)elapsed*1000.0/1024.0);
+
+	Stop();
+	return false;
+}
 
+void TcpSendTestTask::Stop()
+{
 	closesocket(sock);
+	sock = -1;
+}
+
+#define SRAMBACKUP_CHUNKS_PER_STEP 16
+
+//Get that first 64KB! - Smiths
+// Copies one chunk at a time, so that the transfers keep running.
+class SramBackupTask : public Task
+{
+public:
+	SramBackupTask() : savedata(NULL), start(NULL) {}
+
+	void Start();
+	virtual bool Step();
+
+private:
+	FILE* savedata;
+	u8* start;
+};
+
+void SramBackupTask::Start()
+{
+	if(savedata != NULL)
+	{
+		return;
+	}
+
+	savedata = fopen ("fat1:/bank1.sav", "wb");
+	if(savedata == NULL)
+	{
+		printf("Cannot create bank1.sav\n");
+		return;
+	}
+
+	printf("Backing up Bank 1\n");
+	FlashEngine::Acquire();
+	start = SRAM_START; //Beginning of SRAM
+}
+
+bool SramBackupTask::Step()
+{
+	if(savedata == NULL)
+	{
+		return false;
+	}
+
+	u8* bank1 = SRAM_START+65535; //64KB = bank1 (rest need bank switching I believe)
+	char strbuffer[8]; //only likes to work in blocks of 8 (1 byte at a time!)
+
+	for(int i = 0; i < SRAMBACKUP_CHUNKS_PER_STEP && start < bank1 - 1; i++)
+	{
+		VisolyModePreamble (); //Don't know if needed, FLinker has it though
+		memcpy(strbuffer, start, sizeof(strbuffer));
+		fwrite((u8*)strbuffer, 1, sizeof(strbuffer), savedata); //1 byte at a time, whee!
+		start = start+8; //next byte, please
+	}
+
+	if(start < bank1 - 1)
+	{
+		return true;
+	}
+
+	fclose (savedata);
+	savedata = NULL;
+	FlashEngine::Release();
+	printf("Done!\n");
+	printf("File: bank1.sav in root of Slot-1 Device\n");
+	return false;
+}
+
+TcpTestTask tcpTest;
+TcpSendTestTask tcpSendTest;
+SramBackupTask sramBackup;
+
+// Ticks the gui once per frame, starts tests and backups when their keys
+// are pressed, and rescans the cart when the transfers are done.
+class GuiTask : public Task
+{
+public:
+	GuiTask(FwGui::Driver& gui, TftpServer& server)
+	:	gui(gui), server(server), lastFrame(-1), wasBusy(false) {}
+
+	virtual bool Step();
+
+private:
+	FwGui::Driver& gui;
+	TftpServer& server;
+	int lastFrame;
+	bool wasBusy;
+};
+
+bool GuiTask::Step()
+{
+	int frame = Scheduler::GetFrameCount();
+	if(frame == lastFrame)
+	{
+		return false;
+	}
+	lastFrame = frame;
+
+	gui.Tick();
+	if(keysDown() & KEY_X)
+	{
+		tcpTest.Start();
+	}
+	if(keysDown() & KEY_Y)
+	{
+		tcpSendTest.Start();
+	}
+	//Back up SRAM Bank 1 with SELECT - Smiths
+	if(keysDown() & KEY_SELECT)
+	{
+		sramBackup.Start();
+	}
+	if(keysDown() & KEY_START)
+	{
+		PrintNetworkHeapStats();
+	}
+	if(keysDown() & KEY_L)
+	{
+		PacketTrace::Enable(!PacketTrace::IsEnabled());
+		printf("Packet trace %s\n", PacketTrace::IsEnabled() ? "on" : "off");
+	}
+	if(keysDown() & KEY_B)
+	{
+		if(server.IsBusy())
+		{
+			printf("Not while transferring\n");
+		}
+		else
+		{
+			FlashEngine::UseArm7(!FlashEngine::IsUsingArm7());
+			printf("Flash programmed by the %s\n", FlashEngine::IsUsingArm7() ? "ARM7" : "ARM9");
+		}
+	}
+	if(keysDown() & KEY_A)
+	{
+		if(server.IsBusy())
+		{
+			printf("Not while transferring\n");
+		}
+		else
+		{
+			FlashCartFile::UseDelta(!FlashCartFile::IsUsingDelta());
+			printf("Unchanged blocks %s\n", FlashCartFile::IsUsingDelta() ? "skipped" : "written");
+		}
+	}
+	if(keysDown() & KEY_R)
+	{
+		if(PacketTrace::Save("fat1:/tftpds.trc"))
+		{
+			printf("File: tftpds.trc in root of Slot-1 Device\n");
+		}
+		else
+		{
+			printf("Cannot create tftpds.trc\n");
+		}
+	}
+
+	bool busy = server.IsBusy();
+	if(wasBusy && !busy)
+	{
+		// a failed transfer may leave blocks being erased
+		FlashEngine::Finish();
+		dialog->ScanItems();
+		dialog->RefreshButtons();
+		dialog->Repaint();
+	}
+	wasBusy = busy;
+
+	return false;
 }
 
 int main()
@@ -317,8 +575,11 @@ int main()
 	IPC->mailSize=0;
 
 	consoleDemoInit();
+	TransferHud::SetupConsole();
 	irqInit();
+	irqSet(IRQ_VBLANK, Scheduler::VBlank);
 	irqEnable(IRQ_VBLANK); // needed by swiWaitForVBlank()
+	StartClock();
 
 	fatInitDefault(); // initialize FAT - Smiths
 	
@@ -327,6 +588,11 @@ int main()
 	printf("tftpds v2.5-sr\n");
 	printf("-----------\n");
 	printf("Press SELECT to back up SRAM Bank 1\n");
+	printf("Press START for network memory use\n");
+	printf("Press L to start/stop packet trace\n");
+	printf("Press R to save it to Slot-1\n");
+	printf("Press B to program flash with ARM7\n");
+	printf("Press A to skip unchanged blocks\n");
 	printf("-----------\n");
 
 	try
@@ -353,33 +619,21 @@ int main()
 			(ip >> 24) & 0xFF);
 
 		TftpServer server;
+		GuiTask guiTask(gui, server);
+		TransferHud hud(server);
+
+		Scheduler scheduler;
+		scheduler.AddTask(&server);
+		scheduler.AddTask(&guiTask);
+		scheduler.AddTask(&hud);
+		scheduler.AddTask(&tcpTest);
+		scheduler.AddTask(&tcpSendTest);
+		scheduler.AddTask(&sramBackup);
 
 		while(true)
 		{
-			while(!server.Poll())
-			{
-				gui.Tick();
-				if(keysDown() & KEY_X)
-				{
-					TcpTest();
-				}
-				if(keysDown() & KEY_Y)
-				{
-					TcpSendTest();
-				}
-				//Back up SRAM Bank 1 with SELECT - Smiths
-				if(keysDown() & KEY_SELECT)
-				{
-					BackupSRAM();
-				}
-				swiWaitForVBlank();
-			}
-
-			dialog->ScanItems();
-			dialog->RefreshButtons();
-			dialog->Repaint();
+			scheduler.RunFrame();
 		}
-		
 
 	}
 	catch(const char* exception)
@@ -392,26 +646,3 @@ int main()
 		swiWaitForVBlank();
 	}
 }
-
-//Get that first 64KB! - Smiths
-void BackupSRAM() {
-
-FILE * savedata = fopen ("fat1:/bank1.sav", "wb");
-printf("Backing up Bank 1\n");
-u8* start = SRAM_START; //Beginning of SRAM
-u8* bank1 = SRAM_START+65535; //64KB = bank1 (rest need bank switching I believe)
-u8* end = SRAM_END; //unused, but eventually (hopefully) map to end of SRAM for proper 256KB dump
-char strbuffer[8]; //only likes to work in blocks of 8 (1 byte at a time!)
-
-while (start < bank1 - 1) {
-	VisolyModePreamble (); //Don't know if needed, FLinker has it though
-	memcpy(strbuffer, start, sizeof(strbuffer));
-	fwrite((u8*)strbuffer, 1, sizeof(strbuffer), savedata); //1 byte at a time, whee!
-	start = start+8; //next byte, please
-	}
-
-fclose (savedata);
-printf("Done!\n");
-printf("File: bank1.sav in root of Slot-1 Device\n");
-}
-
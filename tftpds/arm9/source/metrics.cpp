@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include "metrics.h"
+
+Metric* Metric::first = NULL;
+
+// Static objects are constructed before main, so there is nothing else
+// touching the list yet.
+Metric::Metric(const char* name)
+:	name(name),
+	next(NULL)
+{
+	Metric** last = &first;
+	while(*last != NULL)
+	{
+		last = &(*last)->next;
+	}
+	*last = this;
+}
+
+bool Counter::FormatLine(int line, char* text) const
+{
+	if(line != 0)
+	{
+		return false;
+	}
+	sprintf(text, "%s %u\n", GetName(), value);
+	return true;
+}
+
+Histogram::Histogram(const char* name)
+:	Metric(name),
+	count(0),
+	sum(0)
+{
+	for(int i = 0; i <= HISTOGRAM_BUCKETS; i++)
+	{
+		buckets[i] = 0;
+	}
+}
+
+void Histogram::Record(u32 value)
+{
+	// the smallest bucket whose bound is at least value, or the last one
+	int bucket = 0;
+	while(bucket < HISTOGRAM_BUCKETS && value > (1u << bucket))
+	{
+		bucket++;
+	}
+	buckets[bucket]++;
+	count++;
+	sum += value;
+}
+
+bool Histogram::FormatLine(int line, char* text) const
+{
+	if(line < HISTOGRAM_BUCKETS)
+	{
+		u32 cumulative = 0;
+		for(int i = 0; i <= line; i++)
+		{
+			cumulative += buckets[i];
+		}
+		sprintf(text, "%s_bucket{le=\"%u\"} %u\n", GetName(), 1u << line, cumulative);
+	}
+	else if(line == HISTOGRAM_BUCKETS)
+	{
+		sprintf(text, "%s_bucket{le=\"+Inf\"} %u\n", GetName(), count);
+	}
+	else if(line == HISTOGRAM_BUCKETS + 1)
+	{
+		sprintf(text, "%s_count %u\n", GetName(), count);
+	}
+	else if(line == HISTOGRAM_BUCKETS + 2)
+	{
+		sprintf(text, "%s_sum %llu\n", GetName(), (unsigned long long)sum);
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
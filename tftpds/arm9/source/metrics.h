@@ -0,0 +1,67 @@
+#pragma once
+
+#include "platform.h"
+
+// Something that is measured, with a name that is unique among all metrics.
+// Metrics are meant to be static objects, and register themselves so that
+// they can be listed by going through GetFirst and GetNext.
+class Metric
+{
+public:
+	Metric(const char* name);
+	virtual ~Metric() {};
+
+	// Writes line number line of this metric, including the newline, and
+	// returns false if there is no such line. Lines fit in
+	// METRIC_MAX_LINELENGTH characters.
+	virtual bool FormatLine(int line, char* text) const = 0;
+
+	const char* GetName() const { return name; }
+	const Metric* GetNext() const { return next; }
+	static const Metric* GetFirst() { return first; }
+
+private:
+	const char* name;
+	Metric* next;
+	static Metric* first;
+};
+
+#define METRIC_MAX_LINELENGTH 80
+
+// A number that goes up, or a value that is set, written as "name value".
+class Counter : public Metric
+{
+public:
+	Counter(const char* name) : Metric(name), value(0) {}
+
+	void Add(unsigned int n) { value += n; }
+	void Increment() { value++; }
+	void Set(unsigned int n) { value = n; }
+	unsigned int Get() const { return value; }
+
+	virtual bool FormatLine(int line, char* text) const;
+
+private:
+	unsigned int value;
+};
+
+#define HISTOGRAM_BUCKETS 24
+
+// Counts values in buckets whose bounds are powers of two. It is written
+// the way Prometheus writes histograms: a "name_bucket{le="bound"} count"
+// line per bucket, counting the values up to bound, followed by
+// "name_count" and "name_sum".
+class Histogram : public Metric
+{
+public:
+	Histogram(const char* name);
+
+	void Record(u32 value);
+
+	virtual bool FormatLine(int line, char* text) const;
+
+private:
+	u32 buckets[HISTOGRAM_BUCKETS + 1];
+	u32 count;
+	u64 sum;
+};
@@ -0,0 +1,142 @@
+#include <nds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "networkheap.h"
+#include "slabpool.h"
+#include "metrics.h"
+
+// sgIP asks for small records (sockets, arp and dns entries) and for its
+// packet buffers, which hold 1600 bytes of data plus a header. Only the tcp
+// buffers, which are used by the network tests, are left to malloc.
+// The classes are sized by what network_alloc_bytes in /stats/ counts: the
+// small and medium ones end at bounds of its buckets, and the packet one is
+// network_alloc_largest. PrintNetworkHeapStats lists each size asked for.
+// How many blocks a class needs is the "max" it prints after a busy
+// transfer, plus some room for the network tests.
+#define NETWORKHEAP_SMALL_SIZE 64
+#define NETWORKHEAP_SMALL_COUNT 48
+#define NETWORKHEAP_MEDIUM_SIZE 256
+#define NETWORKHEAP_MEDIUM_COUNT 16
+#define NETWORKHEAP_PACKET_SIZE 1664
+#define NETWORKHEAP_PACKET_COUNT 32
+#define NETWORKHEAP_CLASSES 3
+
+static u8 smallMemory[NETWORKHEAP_SMALL_SIZE * NETWORKHEAP_SMALL_COUNT] __attribute__((aligned(32)));
+static u8 mediumMemory[NETWORKHEAP_MEDIUM_SIZE * NETWORKHEAP_MEDIUM_COUNT] __attribute__((aligned(32)));
+static u8 packetMemory[NETWORKHEAP_PACKET_SIZE * NETWORKHEAP_PACKET_COUNT] __attribute__((aligned(32)));
+
+static SlabPool pools[NETWORKHEAP_CLASSES] = {
+	SlabPool(smallMemory, NETWORKHEAP_SMALL_SIZE, NETWORKHEAP_SMALL_COUNT),
+	SlabPool(mediumMemory, NETWORKHEAP_MEDIUM_SIZE, NETWORKHEAP_MEDIUM_COUNT),
+	SlabPool(packetMemory, NETWORKHEAP_PACKET_SIZE, NETWORKHEAP_PACKET_COUNT)
+};
+
+// the sizes asked for, and how often
+#define NETWORKHEAP_SIZES 16
+
+static Histogram requestSizes("network_alloc_bytes");
+static Counter largest("network_alloc_largest");
+static Counter oversize("network_alloc_oversize");
+static Counter failures("network_alloc_failures");
+static int sizes[NETWORKHEAP_SIZES];
+static unsigned int sizeCounts[NETWORKHEAP_SIZES];
+
+static void CountSize(int size)
+{
+	requestSizes.Record(size);
+	if((unsigned int)size > largest.Get())
+	{
+		largest.Set(size);
+	}
+
+	for(int i = 0; i < NETWORKHEAP_SIZES; i++)
+	{
+		if(sizeCounts[i] == 0 || sizes[i] == size)
+		{
+			sizes[i] = size;
+			sizeCounts[i]++;
+			return;
+		}
+	}
+}
+
+void* NetworkAlloc(int size)
+{
+	// sgIP is called from interrupts as well
+	u32 ime = REG_IME;
+	REG_IME = 0;
+
+	CountSize(size);
+
+	void* ptr = NULL;
+	for(int i = 0; i < NETWORKHEAP_CLASSES && ptr == NULL; i++)
+	{
+		if(size <= pools[i].GetBlockSize())
+		{
+			ptr = pools[i].Alloc();
+		}
+	}
+	if(ptr == NULL)
+	{
+		if(size > NETWORKHEAP_PACKET_SIZE)
+		{
+			oversize.Increment();
+		}
+		ptr = malloc(size);
+		if(ptr == NULL)
+		{
+			failures.Increment();
+		}
+	}
+
+	REG_IME = ime;
+	return ptr;
+}
+
+void NetworkFree(void* ptr)
+{
+	if(ptr == NULL)
+	{
+		return;
+	}
+
+	u32 ime = REG_IME;
+	REG_IME = 0;
+
+	bool pooled = false;
+	for(int i = 0; i < NETWORKHEAP_CLASSES && !pooled; i++)
+	{
+		if(pools[i].Contains(ptr))
+		{
+			pools[i].Free(ptr);
+			pooled = true;
+		}
+	}
+	if(!pooled)
+	{
+		free(ptr);
+	}
+
+	REG_IME = ime;
+}
+
+void PrintNetworkHeapStats()
+{
+	printf("Network heap:\n");
+	for(int i = 0; i < NETWORKHEAP_CLASSES; i++)
+	{
+		printf("  %4i: %2i/%2i used, max %2i, full %u\n",
+			pools[i].GetBlockSize(),
+			pools[i].GetInUse(),
+			pools[i].GetBlockCount(),
+			pools[i].GetHighWater(),
+			pools[i].GetFailures());
+	}
+	printf("  largest %u, oversize %u, failed %u\n", largest.Get(), oversize.Get(), failures.Get());
+	printf("  asked for");
+	for(int i = 0; i < NETWORKHEAP_SIZES && sizeCounts[i] != 0; i++)
+	{
+		printf(" %ix%u", sizes[i], sizeCounts[i]);
+	}
+	printf("\n");
+}
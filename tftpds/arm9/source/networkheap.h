@@ -0,0 +1,10 @@
+#pragma once
+
+// Memory for dswifi, which asks for it through sgIP_malloc. Requests are
+// served from a few size classes instead of malloc, so that handling a
+// packet is cheap and doesn't fragment the heap the transfers live on.
+// Anything bigger than the largest class, or arriving when its class is
+// used up, still goes to malloc.
+void* NetworkAlloc(int size);
+void NetworkFree(void* ptr);
+void PrintNetworkHeapStats();
@@ -0,0 +1,141 @@
+#include "platform.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "packettrace.h"
+#include "tftpprotocol.h"
+#include "clock.h"
+#include "metrics.h"
+
+static Counter packetsTraced("packettrace_records");
+static Counter recordsOverwritten("packettrace_overwritten");
+
+// only taken from the heap once the first trace is started, and kept so
+// that the trace can be retrieved after it is stopped
+static u8* ring = NULL;
+
+static const PacketTraceHeader header =
+{
+	{ 'T', 'T', 'R', 'C' },
+	PACKETTRACE_VERSION,
+	sizeof(PacketTraceHeader)
+};
+
+bool PacketTrace::recording = false;
+int PacketTrace::paused = 0;
+u32 PacketTrace::head = 0;
+u32 PacketTrace::tail = 0;
+
+void PacketTrace::Enable(bool enable)
+{
+	if(enable && ring == NULL)
+	{
+		ring = new u8[PACKETTRACE_SIZE];
+	}
+	if(enable && !recording)
+	{
+		// a new trace
+		head = tail = 0;
+	}
+	recording = enable;
+}
+
+void PacketTrace::Append(int flags, int localPort, const struct sockaddr_in& remote, const void* packet, int length)
+{
+	int captured = length;
+	if(length >= 2 && ntohs(*(const u16*)packet) == TFTP_MSG_DATA)
+	{
+		captured = (length < TFTP_HEADERSIZE) ? length : TFTP_HEADERSIZE;
+	}
+	else if(captured > TFTP_MAX_REQUESTSIZE + 1)
+	{
+		captured = TFTP_MAX_REQUESTSIZE + 1;
+	}
+
+	PacketTraceRecord record;
+	record.time = GetMicros();
+	record.size = (sizeof(record) + captured + 3) & ~3;
+	record.length = length;
+	record.flags = flags;
+	record.reserved = 0;
+	record.localPort = localPort;
+	record.address = remote.sin_addr.s_addr;
+	record.port = remote.sin_port;
+	record.captured = captured;
+
+	// make room by dropping the oldest records
+	while(head + record.size - tail > PACKETTRACE_SIZE)
+	{
+		u16 size;
+		Copy(tail + offsetof(PacketTraceRecord, size), &size, sizeof(size));
+		tail += size;
+		recordsOverwritten.Increment();
+	}
+
+	CopyIn(head, &record, sizeof(record));
+	CopyIn(head + sizeof(record), packet, captured);
+	head += record.size;
+	packetsTraced.Increment();
+}
+
+void PacketTrace::CopyIn(u32 position, const void* source, int length)
+{
+	int offset = position & (PACKETTRACE_SIZE - 1);
+	int first = PACKETTRACE_SIZE - offset;
+	if(first > length)
+	{
+		first = length;
+	}
+	memcpy(ring + offset, source, first);
+	memcpy(ring, (const u8*)source + first, length - first);
+}
+
+// Positions before tail are in the header.
+int PacketTrace::Copy(u32 position, void* dest, int length)
+{
+	if(length > (int)(head - position))
+	{
+		length = head - position;
+	}
+
+	u8* writePtr = (u8*)dest;
+	int left = length;
+	while(left > 0 && (s32)(tail - position) > 0)
+	{
+		*writePtr++ = ((const u8*)&header)[sizeof(header) - (tail - position)];
+		position++;
+		left--;
+	}
+
+	int offset = position & (PACKETTRACE_SIZE - 1);
+	int first = PACKETTRACE_SIZE - offset;
+	if(first > left)
+	{
+		first = left;
+	}
+	memcpy(writePtr, ring + offset, first);
+	memcpy(writePtr + first, ring, left - first);
+	return length;
+}
+
+bool PacketTrace::Save(const char* filename)
+{
+	FILE* f = fopen(filename, "wb");
+	if(f == NULL)
+	{
+		return false;
+	}
+
+	Pause();
+	bool ok = true;
+	char buffer[512];
+	for(u32 position = GetStart(); position != GetEnd() && ok; )
+	{
+		int count = Copy(position, buffer, sizeof(buffer));
+		ok = (fwrite(buffer, 1, count, f) == (size_t)count);
+		position += count;
+	}
+	Resume();
+
+	return (fclose(f) == 0) && ok;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "platform.h"
+
+// room for the records, a power of two
+#define PACKETTRACE_SIZE 0x40000
+
+#define PACKETTRACE_MAGIC "TTRC"
+#define PACKETTRACE_VERSION 1
+
+// flags of a record
+#define PACKETTRACE_OUTBOUND 1 // sent by the server, otherwise received
+#define PACKETTRACE_LISTENER 2 // on the port requests are sent to
+
+// A trace starts with this, followed by the records from the oldest to the
+// newest. Everything is little endian, the way the DS stores it, except the
+// address and port of the client, which are kept as they are on the wire.
+struct PacketTraceHeader
+{
+	char magic[4];
+	u16 version;
+	u16 headerSize;
+};
+
+// A packet that was sent or received. Only the header of DATA messages is
+// kept, all of any other message.
+struct PacketTraceRecord
+{
+	u32 time;      // GetMicros when the packet was sent or received
+	u16 size;      // bytes to the next record, a multiple of 4
+	u16 length;    // length of the packet
+	u8 flags;
+	u8 reserved;
+	u16 localPort; // port of the server end
+	u32 address;   // address of the client
+	u16 port;      // port of the client
+	u16 captured;  // bytes of the packet that follow the record
+};
+
+// Keeps the last PACKETTRACE_SIZE bytes of records of the packets the
+// server sends and receives. Recording is off until it is enabled, which
+// is when the room for it is allocated, and then costs a copy of the
+// header of each packet.
+class PacketTrace
+{
+public:
+	static void Record(int flags, int localPort, const struct sockaddr_in& remote, const void* packet, int length)
+	{
+		if(recording && paused == 0)
+		{
+			Append(flags, localPort, remote, packet, length);
+		}
+	}
+
+	static void Enable(bool enable);
+	static bool IsEnabled() { return recording; }
+	// Recording is paused while the trace is read, so that it doesn't
+	// change under the reader.
+	static void Pause() { paused++; }
+	static void Resume() { paused--; }
+
+	// The trace is the bytes from GetStart up to GetEnd, including the
+	// header, read with Copy.
+	static u32 GetStart() { return tail - sizeof(PacketTraceHeader); }
+	static u32 GetEnd() { return head; }
+	static int Copy(u32 position, void* dest, int length);
+	// Writes the trace to a file, e.g. on FAT. Returns false on failure.
+	static bool Save(const char* filename);
+
+private:
+	static void Append(int flags, int localPort, const struct sockaddr_in& remote, const void* packet, int length);
+	static void CopyIn(u32 position, const void* source, int length);
+
+	static bool recording;
+	static int paused;
+	static u32 head;
+	static u32 tail;
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+// What the server core needs from the machine it runs on: the libnds types,
+// a clock (clock.h), sockets, and the cart and sram in memory at the
+// addresses the DS has them. On the DS it all comes from libnds and dswifi,
+// and the host build gets it from host/hostplatform.h.
+#include <stddef.h>
+
+#ifdef DS
+#include <nds.h>
+#else
+#include "hostplatform.h"
+#endif
+
+#define CART_BASE ((u8*)0x08000000)
+#define SRAM_BASE ((u8*)0x0A000000)
+
+// cartlib takes addresses as 32 bit numbers, so the cart, and anything
+// written to it, must be in the lower 4 GB also on the host
+#define ADDRESS(p) ((u32)(size_t)(p))
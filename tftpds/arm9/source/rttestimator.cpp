@@ -0,0 +1,58 @@
+#include "platform.h"
+#include "rttestimator.h"
+
+RttEstimator::RttEstimator(u32 initialTimeout, u32 minTimeout, u32 maxTimeout)
+:	hasSample(false),
+	srtt(0),
+	rttvar(0),
+	timeout(initialTimeout),
+	minTimeout(minTimeout),
+	maxTimeout(maxTimeout)
+{
+	Clamp();
+}
+
+void RttEstimator::Sample(u32 rtt)
+{
+	if(!hasSample)
+	{
+		// srtt = rtt, rttvar = rtt / 2
+		srtt = rtt << 3;
+		rttvar = rtt << 1;
+		hasSample = true;
+	}
+	else
+	{
+		// srtt += (rtt - srtt) / 8, rttvar += (|rtt - srtt| - rttvar) / 4
+		s32 delta = (s32)rtt - (srtt >> 3);
+		srtt += delta;
+		if(delta < 0)
+		{
+			delta = -delta;
+		}
+		rttvar += delta - (rttvar >> 2);
+	}
+
+	// timeout = srtt + 4 * rttvar, which also ends any backoff
+	timeout = (srtt >> 3) + rttvar;
+	Clamp();
+}
+
+// Doubles the timeout after a retransmission.
+void RttEstimator::Backoff()
+{
+	timeout <<= 1;
+	Clamp();
+}
+
+void RttEstimator::Clamp()
+{
+	if(timeout < minTimeout)
+	{
+		timeout = minTimeout;
+	}
+	else if(timeout > maxTimeout)
+	{
+		timeout = maxTimeout;
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "platform.h"
+
+// Estimates the round trip time to a client and derives the retransmission
+// timeout from it, as described by Jacobson/Karels and RFC 6298. Samples
+// must not be taken from retransmitted packets (Karn's algorithm).
+class RttEstimator
+{
+public:
+	RttEstimator(u32 initialTimeout, u32 minTimeout, u32 maxTimeout);
+
+	void Sample(u32 rtt);
+	void Backoff();
+	u32 GetTimeout() const { return timeout; }
+
+private:
+	void Clamp();
+
+	bool hasSample;
+	s32 srtt;    // smoothed round trip time, times 8
+	s32 rttvar;  // round trip time variation, times 4
+	u32 timeout;
+	u32 minTimeout;
+	u32 maxTimeout;
+};
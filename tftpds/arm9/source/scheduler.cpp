@@ -0,0 +1,52 @@
+#include <nds.h>
+#include "scheduler.h"
+
+static volatile int frameCount = 0;
+
+Scheduler::Scheduler()
+:	numTasks(0)
+{
+}
+
+void Scheduler::AddTask(Task* task)
+{
+	if(numTasks == SCHEDULER_MAX_TASKS)
+	{
+		throw "Too many tasks";
+	}
+
+	tasks[numTasks++] = task;
+}
+
+void Scheduler::RunFrame()
+{
+	int frame = frameCount;
+	while(frameCount == frame)
+	{
+		bool busy = false;
+		for(int i = 0; i < numTasks; i++)
+		{
+			if(tasks[i]->Step())
+			{
+				busy = true;
+			}
+		}
+
+		if(!busy)
+		{
+			// wait for the next frame, wifi timer or packet from the arm7
+			swiIntrWait(1, IRQ_VBLANK | IRQ_TIMER3 | IRQ_IPC_SYNC);
+		}
+	}
+}
+
+// vblank interrupt handler
+void Scheduler::VBlank()
+{
+	frameCount++;
+}
+
+int Scheduler::GetFrameCount()
+{
+	return frameCount;
+}
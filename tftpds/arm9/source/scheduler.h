@@ -0,0 +1,32 @@
+#pragma once
+
+#define SCHEDULER_MAX_TASKS 8
+
+// A piece of work that is run a little at a time. Step must return within
+// a fraction of a frame, and returns true if there is more work to do right
+// away.
+class Task
+{
+public:
+	virtual ~Task() {};
+
+	virtual bool Step() = 0;
+};
+
+// Runs tasks round-robin until the next frame begins. When none of them has
+// anything to do it sleeps until the next interrupt instead of spinning.
+class Scheduler
+{
+public:
+	Scheduler();
+
+	void AddTask(Task* task);
+	void RunFrame();
+
+	static void VBlank();
+	static int GetFrameCount();
+
+private:
+	Task* tasks[SCHEDULER_MAX_TASKS];
+	int numTasks;
+};
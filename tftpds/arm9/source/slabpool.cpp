@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include "slabpool.h"
+
+SlabPool::SlabPool(void* memory, int blockSize, int blockCount)
+:	memory((char*)memory),
+	blockSize(blockSize),
+	blockCount(blockCount),
+	freeList(NULL),
+	inUse(0),
+	highWater(0),
+	failures(0)
+{
+	for(int i = blockCount - 1; i >= 0; i--)
+	{
+		void** block = (void**)(this->memory + i * blockSize);
+		*block = freeList;
+		freeList = block;
+	}
+}
+
+// Returns NULL when all blocks are in use.
+void* SlabPool::Alloc()
+{
+	void** block = (void**)freeList;
+	if(block == NULL)
+	{
+		failures++;
+		return NULL;
+	}
+
+	freeList = *block;
+	inUse++;
+	if(inUse > highWater)
+	{
+		highWater = inUse;
+	}
+	return block;
+}
+
+void SlabPool::Free(void* block)
+{
+	*(void**)block = freeList;
+	freeList = block;
+	inUse--;
+}
+
+bool SlabPool::Contains(const void* block) const
+{
+	return (const char*)block >= memory &&
+		(const char*)block < memory + blockSize * blockCount;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <nds.h>
+
+// Equally sized blocks carved out of memory given to the pool. The free
+// blocks are linked through their first word, so allocating and freeing
+// is a couple of loads and stores.
+class SlabPool
+{
+public:
+	SlabPool(void* memory, int blockSize, int blockCount);
+
+	void* Alloc();
+	void Free(void* block);
+	bool Contains(const void* block) const;
+
+	int GetBlockSize() const { return blockSize; }
+	int GetBlockCount() const { return blockCount; }
+	int GetInUse() const { return inUse; }
+	int GetHighWater() const { return highWater; }
+	unsigned int GetFailures() const { return failures; }
+
+private:
+	char* memory;
+	int blockSize;
+	int blockCount;
+	void* freeList;
+	int inUse;
+	int highWater;
+	unsigned int failures;
+};
@@ -1,17 +1,24 @@
-#include <nds.h>
+#include "platform.h"
 #include <stdio.h>
 #include "sramfile.h"
+#include "flashengine.h"
+#include "metrics.h"
+
+static Counter bytesRead("sram_bytes_read");
+static Counter bytesWritten("sram_bytes_written");
 
 #define min(x, y) ((x)<=(y)?(x):(y))
 
-#define SRAM_START ((u8*)0x0A000000)
-#define SRAM_END ((u8*)0x0A03FFFF) //256KB
-//#define SRAM_END ((u8*)0x0A010000) //64KB
+#define SRAM_START SRAM_BASE
+#define SRAM_END (SRAM_BASE + 0x3FFFF) //256KB
+//#define SRAM_END (SRAM_BASE + 0x10000) //64KB
 
 SramFile::SramFile(const char* filename, bool write)
 :	filePtr(SRAM_START),
 	state(write ? FILESTATE_WRITE : FILESTATE_READ)
 {
+	// the sram is in the GBA slot too
+	FlashEngine::Acquire();
 }
 
 SramFile::~SramFile()
@@ -35,6 +42,8 @@ int SramFile::Read(void* dest, int length)
 		throw "Illegal state";
 	}
 
+	// sram has an 8 bit bus, so it can't be mapped for others to read with
+	// wider accesses, and has to be copied one byte at a time
 	u8* writePtr = (u8*)dest;
 	u8* endPtr = min(filePtr + length, SRAM_END+1);
 
@@ -43,6 +52,7 @@ int SramFile::Read(void* dest, int length)
 		*writePtr++ = *filePtr++;
 	}
 
+	bytesRead.Add(writePtr - (u8*)dest);
 	return (int)(writePtr - (u8*)dest);
 }
 
@@ -62,9 +72,16 @@ void SramFile::Write(void* source, int length)
 	for(int i = 0; i < length; i++) {
 		*filePtr++ = *readPtr++;
 	}
+	bytesWritten.Add(length);
+}
+
+int SramFile::GetLength()
+{
+	return SRAM_END+1 - SRAM_START;
 }
 
 void SramFile::Close()
 {
+	FlashEngine::Release();
 	state = FILESTATE_CLOSED;
 }
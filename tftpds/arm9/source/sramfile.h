@@ -1,7 +1,6 @@
 #pragma once
 
 #include "file.h"
-void BackupSRAM();
 
 class SramFile : public File
 {
@@ -12,6 +11,7 @@ public:
 	virtual int Read(void* dest, int length);
 	virtual void Write(void* source, int length);
 	virtual void Close();
+	virtual int GetLength();
 
 private:
 	u8* filePtr;
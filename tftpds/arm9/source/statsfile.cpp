@@ -0,0 +1,71 @@
+#include "platform.h"
+#include <string.h>
+#include "statsfile.h"
+
+StatsFile::StatsFile(const char* filename, bool write)
+:	metric(Metric::GetFirst()),
+	line(0),
+	textPos(0),
+	textLength(0),
+	state(write ? FILESTATE_WRITE : FILESTATE_READ)
+{
+	if(write)
+	{
+		throw "Stats are read only.";
+	}
+}
+
+StatsFile::~StatsFile()
+{
+}
+
+int StatsFile::Read(void* dest, int length)
+{
+	if(state != FILESTATE_READ)
+	{
+		throw "Illegal state.";
+	}
+
+	char* writePtr = (char*)dest;
+	while(length > 0)
+	{
+		if(textPos == textLength)
+		{
+			if(metric == NULL)
+			{
+				break;
+			}
+			if(!metric->FormatLine(line, text))
+			{
+				metric = metric->GetNext();
+				line = 0;
+				continue;
+			}
+			line++;
+			textPos = 0;
+			textLength = strlen(text);
+		}
+
+		int count = textLength - textPos;
+		if(count > length)
+		{
+			count = length;
+		}
+		memcpy(writePtr, text + textPos, count);
+		writePtr += count;
+		textPos += count;
+		length -= count;
+	}
+
+	return writePtr - (char*)dest;
+}
+
+void StatsFile::Write(void* source, int length)
+{
+	throw "Stats are read only.";
+}
+
+void StatsFile::Close()
+{
+	state = FILESTATE_CLOSED;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "file.h"
+#include "metrics.h"
+
+// The metrics as a read only text file with a line per value. It is made
+// one line at a time as it is read, so that it needs no more memory than a
+// line.
+class StatsFile : public File
+{
+public:
+	StatsFile(const char* filename, bool write);
+	virtual ~StatsFile();
+
+	virtual int Read(void* dest, int length);
+	virtual void Write(void* source, int length);
+	virtual void Close();
+
+private:
+	const Metric* metric;
+	int line;
+	char text[METRIC_MAX_LINELENGTH + 1];
+	int textPos;
+	int textLength;
+	FileState state;
+};
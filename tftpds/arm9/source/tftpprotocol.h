@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#ifdef DS
+#define socklen_t int
+#else
+#include <sys/ioctl.h>
+#endif
+
+// retransmission timeouts in milliseconds, adapted to the measured round
+// trip time of each session
+#define TFTP_INITIAL_TIMEOUT 1000
+#define TFTP_MIN_TIMEOUT 20
+#define TFTP_MAX_TIMEOUT 4000
+#define TFTP_MAX_TIMEOUTS 10
+
+#define TFTP_PORT 69
+#define TFTP_FIRST_SESSION_PORT 49152
+#define TFTP_LAST_SESSION_PORT 65535
+#define TFTP_MAX_SESSIONS 4
+#define TFTP_MAX_REQUESTSIZE 512
+#define TFTP_MAX_ERRORSIZE 128
+
+#define	TFTP_DEFAULT_BLOCKSIZE 512
+#define TFTP_MIN_BLOCKSIZE 8
+// the most that fits in one wifi frame
+#define TFTP_MAX_BLOCKSIZE 1468
+#define TFTP_HEADERSIZE 4
+#define TFTP_MAX_PACKETSIZE (TFTP_HEADERSIZE + TFTP_MAX_BLOCKSIZE)
+#define TFTP_DEFAULT_WINDOWSIZE 1
+#define TFTP_MAX_WINDOWSIZE 16
+
+// received data is staged contiguously in a slot aligned like the flash
+// write blocks, so that whole write blocks can be written from where they
+// were received, and only the rest is copied when the slot is full. The
+// blocks are acknowledged once they are staged, and written behind, at
+// most TFTP_WRITE_BEHIND_SIZE bytes at a time while nothing is received.
+#define TFTP_STAGING_ALIGNMENT 64
+#define TFTP_STAGING_SIZE 0x6000
+#define TFTP_WRITE_BEHIND_SIZE 512
+
+// the packet buffer of each session has room for the largest window when
+// sending, which is also enough for the staging slot when receiving
+#define TFTP_SESSION_BUFFER_SIZE (TFTP_MAX_PACKETSIZE * (TFTP_MAX_WINDOWSIZE + 1) + 1)
+
+#define TFTP_OPTION_BLKSIZE    0x01
+#define TFTP_OPTION_WINDOWSIZE 0x02
+#define TFTP_OPTION_TSIZE      0x04
+#define TFTP_OPTION_VERIFY     0x08
+
+#define	TFTP_MSG_RRQ   01  // read request
+#define	TFTP_MSG_WRQ   02  // write request
+#define	TFTP_MSG_DATA  03  // data packet
+#define	TFTP_MSG_ACK   04  // acknowledgement
+#define	TFTP_MSG_ERROR 05  // error code
+#define	TFTP_MSG_OACK  06  // option acknowledgement
+
+struct TftpMsg
+{
+	short op;
+};
+
+struct TftpMsgRrq
+{
+	short op;
+	char options[];
+};
+
+struct TftpMsgWrq
+{
+	short op;
+	char options[];
+};
+
+struct TftpMsgData
+{
+	short op;
+	short block;
+	char data[];
+};
+
+struct TftpMsgAck
+{
+	short op;
+	short block;
+};
+
+struct TftpMsgError
+{
+	short op;
+	short error;
+	char message[];
+};
+
+struct TftpMsgOAck
+{
+	short op;
+	char options[];
+};
+
+#define	TFTP_EUNDEF    0  // Not defined, see error message (if any).
+#define	TFTP_ENOTFOUND 1  // File not found.
+#define	TFTP_EACCESS   2  // Access violation.
+#define	TFTP_ENOSPACE  3  // Disk full or allocation exceeded.
+#define	TFTP_EBADOP    4  // Illegal TFTP operation.
+#define	TFTP_EBADID    5  // Unknown transfer ID.
+#define	TFTP_EEXISTS   6  // File already exists.
+#define	TFTP_ENOUSER   7  // No such user.
+
+// the message has to outlive the throw, so it is kept in a static buffer
+#define THROW_ERRNO(s) {static char e[256]; snprintf(e, sizeof(e), "%s: %s (%i) (%s:%i)", s, strerror(errno), errno, __FILE__, __LINE__); throw e;}
+#define THROW(s) throw s;
@@ -2,101 +2,39 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <new>
 #include "tftpserver.h"
-#include "filefactory.h"
+#include "tftpsession.h"
+#include "allocation.h"
+#include "metrics.h"
+#include "packettrace.h"
+#include "catalog.h"
 
-#ifdef DS
-#define socklen_t int
-#else
-#include <sys/ioctl.h>
-#endif
+static Counter requests("tftp_requests");
+static Counter rejected("tftp_requests_rejected");
+static Counter transferAllocations("tftp_allocations");
 
-#include <nds.h>
-#include <memory>
+#include "platform.h"
 
-extern void WaitForVBlank();
-extern void ResetTimer();
-extern int GetTimer();
-
-#define TFTP_TIMEOUT 2
-#define TFTP_MAX_TIMEOUTS 10
-
-#define TFTP_PORT 69
-#define	TFTP_DEFAULT_BLOCKSIZE 512
-#define TFTP_HEADERSIZE 4
-
-#define	TFTP_MSG_RRQ   01  // read request
-#define	TFTP_MSG_WRQ   02  // write request
-#define	TFTP_MSG_DATA  03  // data packet
-#define	TFTP_MSG_ACK   04  // acknowledgement
-#define	TFTP_MSG_ERROR 05  // error code
-#define	TFTP_MSG_OACK  06  // option acknowledgement
-
-struct TftpMsg
-{
-	short op;
-};
-
-struct TftpMsgRrq
-{
-	short op;
-	char options[];
-};
-
-struct TftpMsgWrq
-{
-	short op;
-	char options[];
-};
-
-struct TftpMsgData
-{
-	short op;
-	short block;
-	char data[];
-};
-
-struct TftpMsgAck
-{
-	short op;
-	short block;
-};
-
-struct TftpMsgError
-{
-	short op;
-	short error;
-	char message[];
-};
-
-struct TftpMsgOAck
+TftpServer::TftpServer(int port)
+:	localPort(port),
+	nextSession(0),
+	nextPort(TFTP_FIRST_SESSION_PORT),
+	allocations(0)
 {
-	short op;
-	char options[];
-};
-
-#define	TFTP_EUNDEF    0  // Not defined, see error message (if any).
-#define	TFTP_ENOTFOUND 1  // File not found.
-#define	TFTP_EACCESS   2  // Access violation.
-#define	TFTP_ENOSPACE  3  // Disk full or allocation exceeded.
-#define	TFTP_EBADOP    4  // Illegal TFTP operation.
-#define	TFTP_EBADID    5  // Unknown transfer ID.
-#define	TFTP_EEXISTS   6  // File already exists.
-#define	TFTP_ENOUSER   7  // No such user.
-
-#define THROW_ERRNO(s) {char e[1024]; sprintf(e, "%s: %s (%i) (%s:%i)", s, strerror(errno), errno, __FILE__, __LINE__); throw e;}
-#define THROW(s) throw s;
+	for(int i = 0; i < TFTP_MAX_SESSIONS; i++)
+	{
+		sessions[i] = NULL;
+	}
 
-TftpServer::TftpServer()
-{
 	// create socket
 	sock = socket(AF_INET, SOCK_DGRAM, 0);
 	if(sock == -1) { THROW_ERRNO("socket"); }
 
-	// bind to default port
+	// bind to the tftp port
 	struct sockaddr_in sain;
 	sain.sin_family = AF_INET;
-	sain.sin_port = htons(TFTP_PORT);
+	sain.sin_port = htons(port);
 	sain.sin_addr.s_addr = INADDR_ANY;
 	int result = bind(sock, (struct sockaddr *)&sain, sizeof(sain));
 	if(result == -1) { THROW_ERRNO("bind"); }
@@ -110,326 +48,169 @@ TftpServer::TftpServer()
 
 TftpServer::~TftpServer()
 {
-	close(sock);
-}
-
-bool TftpServer::Poll()
-{
-	socklen_t remotelen = sizeof(remote);
-	char buffer[2048];
-
-	int count = recvfrom(
-		sock,
-		buffer,
-		sizeof(buffer),
-		0,
-		(struct sockaddr *)&remote,
-		&remotelen);
-	if(count == -1)
+	for(int i = 0; i < TFTP_MAX_SESSIONS; i++)
 	{
-		if(errno != EAGAIN)
+		if(sessions[i] != NULL)
 		{
-			THROW_ERRNO("recvfrom");
+			sessions[i]->~TftpSession();
 		}
-		return false;
 	}
 
-	unsigned int ip = remote.sin_addr.s_addr;
-	printf("%u.%u.%u.%u:%u connected\n",
-		(ip >>  0) & 0xFF,
-		(ip >>  8) & 0xFF,
-		(ip >> 16) & 0xFF,
-		(ip >> 24) & 0xFF,
-		ntohs(remote.sin_port));
+	close(sock);
+}
 
-	timeouts = 0;
+// Accepts a new request and gives each running session a turn. Returns
+// true if anything happened. Everything a transfer needs comes from the
+// arena, so nothing here should allocate.
+bool TftpServer::Step()
+{
+	unsigned int allocationCount = GetAllocationCount();
+	bool busy = Accept();
 
-	try
+	// start with a different session each time, so that no session gets
+	// to starve the others
+	for(int i = 0; i < TFTP_MAX_SESSIONS; i++)
 	{
-		TftpMsg* msg = (TftpMsg*)buffer;
-		switch(ntohs(msg->op))
+		int index = (nextSession + i) % TFTP_MAX_SESSIONS;
+		TftpSession* session = sessions[index];
+		if(session == NULL)
 		{
-		case TFTP_MSG_RRQ:
-			{
-				TftpMsgRrq* rrqMsg = (TftpMsgRrq*)msg;
-				ParseOptions(rrqMsg->options, count-2);
-				SendFile();
-			}
-			break;
+			continue;
+		}
 
-		case TFTP_MSG_WRQ:
-			{
-				TftpMsgWrq* wrqMsg = (TftpMsgWrq*)msg;
-				ParseOptions(wrqMsg->options, count-2);
-				ReceiveFile();
-			}
-			break;
+		if(session->Step())
+		{
+			busy = true;
+		}
 
-		default:
-			THROW("Unexpected operation");
+		if(session->IsFinished())
+		{
+			session->~TftpSession();
+			sessions[index] = NULL;
 		}
 	}
-	catch(const char* exception)
-	{
-		printf("\nError: %s\n", exception);
-		SendError(exception);
-	}
+	nextSession = (nextSession + 1) % TFTP_MAX_SESSIONS;
 
-	return true;
-}
-
-void TftpServer::ReceiveFile()
-{
-	File* file = FileFactory::OpenFile(filename, true);
-
-	if(blocksize != -1)
+	// a full catalog is written anew after the transfer that filled it
+	if(!IsBusy() && Catalog::Step())
 	{
-		SendOAck();
+		busy = true;
 	}
-	else
+
+	allocationCount = GetAllocationCount() - allocationCount;
+	if(allocationCount != 0)
 	{
-		blocksize = TFTP_DEFAULT_BLOCKSIZE;
-		SendAck(0);
+		allocations += allocationCount;
+		transferAllocations.Add(allocationCount);
+		printf("Warning: %u allocations during transfer\n", allocations);
 	}
 
+	return busy;
+}
 
-	unsigned short lastReceivedBlock = 0;
-	unsigned int bytesReceived = 0;
-	int length = blocksize;
-	std::auto_ptr<char> buffer(new char[TFTP_HEADERSIZE + blocksize]);
-	SendAck(lastReceivedBlock);
-	printf("Received: \e[s    0 k");
-	while(length == blocksize)
+bool TftpServer::IsBusy() const
+{
+	for(int i = 0; i < TFTP_MAX_SESSIONS; i++)
 	{
-		int count = ReceiveMsg(buffer.get());
-		if(count < 0)
+		if(sessions[i] != NULL)
 		{
-			SendAck(lastReceivedBlock);
-			continue;
+			return true;
 		}
-
-		TftpMsg* msg = (TftpMsg*)buffer.get();
-		switch(ntohs(msg->op))
-		{
-		case TFTP_MSG_DATA:
-			{
-				TftpMsgData* dataMsg = (TftpMsgData*)msg;
-				if(ntohs(dataMsg->block) != ((lastReceivedBlock+1) & 0xFFFF))
-				{
-					printf("\e[u\e[0Kout of order (%u)", lastReceivedBlock);
-					
-					// we should only send an ack if the block number is too high
-					// see http://en.wikipedia.org/wiki/Sorcerer%27s_Apprentice_Syndrome
-					if(ntohs(dataMsg->block) > ((lastReceivedBlock+1) & 0xFFFF))
-					{
-						SendAck(lastReceivedBlock);
-					}
-
-					continue;
-				}
-				lastReceivedBlock = (lastReceivedBlock + 1) & 0xFFFF;
-				length = count - TFTP_HEADERSIZE;
-				if(length > 0)
-				{
-					file->Write(dataMsg->data, length);
-				}
-
-				bytesReceived += length;
-				printf("\e[u\e[0K%5u k", bytesReceived >> 10);
-			}
-			break;
-
-		case TFTP_MSG_ERROR:
-			{
-				TftpMsgError* errMsg = (TftpMsgError*)msg;
-				THROW(errMsg->message);
-			}
-
-		default:
-			THROW("Unexpected operation");
-		}
-
-		SendAck(lastReceivedBlock);
 	}
-
-	file->Close();
-	delete file;
-	printf("\nFile received successfully.\n");
+	return false;
 }
 
-void TftpServer::SendFile()
+bool TftpServer::Accept()
 {
-	if(blocksize != -1)
-	{
-		SendOAck();
-	}
-	else
-	{
-		blocksize = TFTP_DEFAULT_BLOCKSIZE;
-	}
-
-	File* file = FileFactory::OpenFile(filename, false);
-
-	printf("Sent: \e[s    0 k");
+	struct sockaddr_in remote;
+	socklen_t remotelen = sizeof(remote);
 
-	unsigned short lastSentBlock = 0;
-	unsigned int blocksAcked = 0;
-	int length = blocksize;
-	std::auto_ptr<char> buffer(new char[TFTP_HEADERSIZE + blocksize]);
-	while(length == blocksize)
+	// a request that doesn't fit is cut short, and then rejected by the
+	// session since it is longer than TFTP_MAX_REQUESTSIZE
+	int count = recvfrom(
+		sock,
+		request,
+		sizeof(request),
+		0,
+		(struct sockaddr *)&remote,
+		&remotelen);
+	if(count == -1)
 	{
-		lastSentBlock = (lastSentBlock + 1) & 0xFFFF;
-		TftpMsgData* data = (TftpMsgData*)buffer.get();
-		data->op = htons(TFTP_MSG_DATA);
-		data->block = htons(lastSentBlock);
-		length = file->Read(data->data, blocksize);
-		bool acked = false;
-		while(!acked)
+		if(errno != EAGAIN)
 		{
-			SendDataMsg(buffer.get(), TFTP_HEADERSIZE + length);
-
-			if(ReceiveMsg(buffer.get()) < 0)
-			{
-				continue;
-			}
-
-			TftpMsg* msg = (TftpMsg*)buffer.get();
-			switch(ntohs(msg->op))
-			{
-			case TFTP_MSG_ACK:
-				{
-					TftpMsgAck* ackMsg = (TftpMsgAck*)msg;
-					if(ntohs(ackMsg->block) == lastSentBlock)
-					{
-						acked = true;
-						blocksAcked++;
-						printf("\e[u\e[0K%5u k", blocksAcked/2);
-					}
-				}
-				break;
-
-			case TFTP_MSG_ERROR:
-				{
-					TftpMsgError* errMsg = (TftpMsgError*)msg;
-					THROW(errMsg->message);
-				}
-
-			default:
-				THROW("Unexpected operation");
-			}
+			THROW_ERRNO("recvfrom");
 		}
+		return false;
 	}
+	PacketTrace::Record(PACKETTRACE_LISTENER, localPort, remote, request, count);
 
-	file->Close();
-	delete file;
-	printf("\nFile sent successfully.\n");
-}
+	requests.Increment();
 
-int TftpServer::ReceiveMsg(void* buffer)
-{
-	int count;
-	ResetTimer();
-	do
+	int freeIndex = -1;
+	for(int i = 0; i < TFTP_MAX_SESSIONS; i++)
 	{
-		socklen_t remotelen = sizeof(remote);
-		count = recvfrom(
-			sock,
-			buffer,
-			TFTP_HEADERSIZE + blocksize,
-			0,
-			(struct sockaddr *)&remote, &remotelen);
-		if(count >= 0)
+		if(sessions[i] == NULL)
 		{
-			timeouts = 0;
-			return count;
+			freeIndex = i;
+		}
+		else if(sessions[i]->IsClient(remote))
+		{
+			// the client resent its request before our reply arrived
+			return true;
 		}
 	}
-	while(GetTimer() < TFTP_TIMEOUT);
 
-	printf("\e[u\e[0Ktimeout %i", timeouts);
-	timeouts++;
-	if(timeouts > TFTP_MAX_TIMEOUTS)
+	unsigned int ip = remote.sin_addr.s_addr;
+	printf("%u.%u.%u.%u:%u connected\n",
+		(ip >>  0) & 0xFF,
+		(ip >>  8) & 0xFF,
+		(ip >> 16) & 0xFF,
+		(ip >> 24) & 0xFF,
+		ntohs(remote.sin_port));
+
+	if(freeIndex == -1)
 	{
-		THROW("Transfer timed out");
+		printf("Error: Too many transfers\n");
+		rejected.Increment();
+		SendError(remote, TFTP_EUNDEF, "Too many transfers");
+		return true;
 	}
-	return -1;
-}
-
-void TftpServer::SendDataMsg(void* buffer, int length)
-{
-	int count = sendto(
-		sock,
-		buffer,
-		length,
-		0,
-		(struct sockaddr *)&remote,
-		sizeof(remote));
-	if(count == -1) { THROW_ERRNO("sendto"); }
-}
 
-void TftpServer::SendAck(int block)
-{
-	TftpMsgAck ackMsg;
-	ackMsg.op = htons(TFTP_MSG_ACK);
-	ackMsg.block = htons(block);
-	
-	int count = sendto(sock, &ackMsg, sizeof(ackMsg), 0, (struct sockaddr *)&remote, sizeof(remote));
-	if(count == -1) { THROW_ERRNO("sendto"); }
+	TftpSession* session = new(arena.GetSession(freeIndex)) TftpSession(
+		remote,
+		arena.GetFile(freeIndex),
+		arena.GetBuffer(freeIndex));
+	if(!session->Start(NextPort(), request, count))
+	{
+		// the session couldn't get a port, so it is answered from this one
+		SendError(remote, TFTP_EUNDEF, "No port for the transfer");
+	}
+	sessions[freeIndex] = session;
+	return true;
 }
 
-void TftpServer::SendError(const char* error)
+void TftpServer::SendError(const struct sockaddr_in& remote, int code, const char* error)
 {
-	int length = TFTP_HEADERSIZE + strlen(error) + 1;
-	TftpMsgError* errMsg = (TftpMsgError*)new char[length];
-	
+	char buffer[TFTP_HEADERSIZE + TFTP_MAX_ERRORSIZE];
+	TftpMsgError* errMsg = (TftpMsgError*)buffer;
 	errMsg->op = htons(TFTP_MSG_ERROR);
-	// TODO: curl ignores the message, so we should set the correct error code
-	errMsg->error = htons(TFTP_EACCESS);
-	strcpy(errMsg->message, error);
+	errMsg->error = htons(code);
+	strncpy(errMsg->message, error, TFTP_MAX_ERRORSIZE - 1);
+	errMsg->message[TFTP_MAX_ERRORSIZE - 1] = '\0';
 
+	int length = TFTP_HEADERSIZE + strlen(errMsg->message) + 1;
+	PacketTrace::Record(PACKETTRACE_OUTBOUND | PACKETTRACE_LISTENER, localPort, remote, errMsg, length);
 	sendto(sock, errMsg, length, 0, (struct sockaddr *)&remote, sizeof(remote));
-
-	delete errMsg;
 }
 
-void TftpServer::ParseOptions(const char* options, int length)
+// Each session gets a port of its own, which is its transfer ID in RFC 1350.
+int TftpServer::NextPort()
 {
-	const char* ptr = options;
-	const char* end = ptr + length;
-	filename = ptr;
-	ptr += strlen(filename) + 1;
-	mode = ptr;
-	ptr += strlen(mode) + 1;
-	blocksize = -1;
-	while(ptr < end)
+	int port = nextPort;
+	nextPort++;
+	if(nextPort > TFTP_LAST_SESSION_PORT)
 	{
-		const char* option = ptr;
-		ptr += strlen(option) + 1;
-		const char* value = ptr;
-		ptr += strlen(value) + 1;
-		printf("option: %s=%s\n", option, value);
-		if(strcmp(option, "blksize") == 0)
-		{
-			sscanf(value, "%i", &blocksize);
-		}
+		nextPort = TFTP_FIRST_SESSION_PORT;
 	}
-}
-
-void TftpServer::SendOAck()
-{
-	char buffer[1024];
-	TftpMsgOAck* msg = (TftpMsgOAck*)buffer;
-	msg->op = htons(TFTP_MSG_OACK);
-	strcpy(msg->options, "blksize");
-	char str[1024];
-	sprintf(str, "%i", blocksize);
-	strcpy(msg->options + strlen("blksize") + 1, str);
-	int count = sendto(
-		sock,
-		buffer,
-		2 + strlen("blksize") + 1 + strlen(str) + 1,
-		0,
-		(struct sockaddr *)&remote,
-		sizeof(remote));
-	if(count == -1) { THROW_ERRNO("sendto"); }
+	return port;
 }
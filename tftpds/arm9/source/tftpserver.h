@@ -2,29 +2,34 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include "tftpprotocol.h"
+#include "scheduler.h"
+#include "transferarena.h"
 
-class TftpServer
+class TftpSession;
+
+class TftpServer : public Task
 {
 public:
-	TftpServer();
-	~TftpServer();
+	TftpServer(int port = TFTP_PORT);
+	virtual ~TftpServer();
 
-	bool Poll();
+	virtual bool Step();
+	bool IsBusy() const;
+	// Returns the session in the given slot, or NULL if there is none.
+	const TftpSession* GetSession(int slot) const { return sessions[slot]; }
 
 private:
-	void ReceiveFile();
-	void SendFile();
-	int ReceiveMsg(void* buffer);
-	void SendDataMsg(void* buffer, int length);
-	void SendAck(int block);
-	void SendError(const char* error);
-	void ParseOptions(const char* options, int length);
-	void SendOAck();
-	
+	bool Accept();
+	void SendError(const struct sockaddr_in& remote, int code, const char* error);
+	int NextPort();
+
 	int sock;
-	struct sockaddr_in remote;
-	int timeouts;
-	const char* filename;
-	const char* mode;
-	int blocksize;
+	int localPort;
+	TransferArena arena;
+	TftpSession* sessions[TFTP_MAX_SESSIONS];
+	int nextSession;
+	int nextPort;
+	char request[TFTP_MAX_REQUESTSIZE + 1];
+	unsigned int allocations;
 };
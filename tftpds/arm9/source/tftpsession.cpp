@@ -0,0 +1,933 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef DS
+#include <sys/uio.h>
+#endif
+#include "tftpsession.h"
+#include "filefactory.h"
+#include "clock.h"
+#include "metrics.h"
+#include "packettrace.h"
+
+static Counter transfersOk("tftp_transfers_ok");
+static Counter transfersFailed("tftp_transfers_failed");
+static Counter bytesReceivedTotal("tftp_bytes_received");
+static Counter bytesSentTotal("tftp_bytes_sent");
+static Counter retransmitsTotal("tftp_retransmits");
+static Counter outOfOrderTotal("tftp_out_of_order");
+static Counter timeoutsTotal("tftp_timeouts");
+static Counter lastTransferBytes("tftp_last_transfer_bytes");
+static Counter lastTransferMillis("tftp_last_transfer_ms");
+static Histogram roundTrip("tftp_rtt_ms");
+static Histogram transferTime("tftp_transfer_ms");
+static Histogram writeBehind("tftp_write_behind_bytes");
+
+// the values of the "verify" option, in the order of VerifyPolicy
+static const char* verifyNames[] = { "full", "block", "sampled", "off" };
+
+#include "platform.h"
+
+// The file is opened in storage, and packets is used for all the packets,
+// which must have room for TFTP_SESSION_BUFFER_SIZE bytes.
+TftpSession::TftpSession(const struct sockaddr_in& client, void* storage, char* packets)
+:	sock(-1),
+	localPort(0),
+	remote(client),
+	state(SESSIONSTATE_FINISHED),
+	fileStorage(storage),
+	file(NULL),
+	filename(NULL),
+	mode(NULL),
+	requestedOptions(0),
+	blocksize(TFTP_DEFAULT_BLOCKSIZE),
+	windowsize(TFTP_DEFAULT_WINDOWSIZE),
+	transferSize(0),
+	verify(VERIFY_BLOCK),
+	packetsize(0),
+	buffer(packets),
+	received(NULL),
+	oackPending(false),
+	timeouts(0),
+	deadline(0),
+	rtt(TFTP_INITIAL_TIMEOUT, TFTP_MIN_TIMEOUT, TFTP_MAX_TIMEOUT),
+	timing(false),
+	timedBlock(0),
+	timedSince(0),
+	staging(NULL),
+	stagingSize(0),
+	streamStart(0),
+	streamEnd(0),
+	bytesCopied(0),
+	lastReceivedBlock(0),
+	bytesReceived(0),
+	blocksUnacked(0),
+	gapAcked(false),
+	mapped(false),
+	packet(NULL),
+	firstUnackedBlock(1),
+	lastBlockSent(0),
+	bytesAcked(0),
+	blocksBuffered(0),
+	lastBlockRead(false),
+	readPending(false)
+{
+	progress.sending = false;
+	progress.startTime = GetMillis();
+	progress.bytes = 0;
+	progress.totalBytes = -1;
+	progress.retransmits = 0;
+	progress.outOfOrder = 0;
+	progress.timeouts = 0;
+}
+
+TftpSession::~TftpSession()
+{
+	FileFactory::CloseFile(file);
+	if(sock != -1)
+	{
+		close(sock);
+	}
+}
+
+bool TftpSession::Start(int port, const char* req, int length)
+{
+	try
+	{
+		ResetDeadline();
+		OpenSocket(port);
+
+		if(length > TFTP_MAX_REQUESTSIZE)
+		{
+			THROW("Request too long");
+		}
+		memcpy(request, req, length);
+		request[length] = '\0';
+
+		TftpMsg* msg = (TftpMsg*)request;
+		switch(ntohs(msg->op))
+		{
+		case TFTP_MSG_RRQ:
+			{
+				TftpMsgRrq* rrqMsg = (TftpMsgRrq*)msg;
+				ParseOptions(rrqMsg->options, length-2);
+				StartSend();
+			}
+			break;
+
+		case TFTP_MSG_WRQ:
+			{
+				TftpMsgWrq* wrqMsg = (TftpMsgWrq*)msg;
+				ParseOptions(wrqMsg->options, length-2);
+				StartReceive();
+			}
+			break;
+
+		default:
+			THROW("Unexpected operation");
+		}
+	}
+	catch(const char* exception)
+	{
+		Fail(exception);
+	}
+	return sock != -1;
+}
+
+bool TftpSession::Step()
+{
+	if(state == SESSIONSTATE_FINISHED)
+	{
+		return false;
+	}
+
+	try
+	{
+		// the file gets on with erasing while we wait for the network
+		bool busy = (file != NULL && file->Step());
+
+		if(state == SESSIONSTATE_RECEIVING && !HasRoom())
+		{
+			// the staging slot can't take another block until more of it
+			// is written, so the client's packets wait in the socket
+			// meanwhile, also while the file holds the data back to erase
+			WriteBehind();
+			if(!HasRoom())
+			{
+				// the wait is ours, not the network's
+				timing = false;
+				ResetDeadline();
+				return true;
+			}
+		}
+
+		if(readPending)
+		{
+			// likewise the acks wait until the file can be read and the
+			// window sent
+			if(!ReadWindow())
+			{
+				timing = false;
+				ResetDeadline();
+				return true;
+			}
+			SendWindow();
+		}
+
+		struct sockaddr_in from;
+		int count = Receive(&from);
+		if(count == -1)
+		{
+			if(CLOCK_BEFORE(GetMillis(), deadline))
+			{
+				return WriteBehind() || busy;
+			}
+
+			progress.timeouts++;
+			timeoutsTotal.Increment();
+			timeouts++;
+			if(timeouts > TFTP_MAX_TIMEOUTS)
+			{
+				THROW("Transfer timed out");
+			}
+			timing = false;
+			rtt.Backoff();
+			HandleTimeout();
+			ResetDeadline();
+			return true;
+		}
+
+		if(!IsClient(from))
+		{
+			// someone else is sending to our port, see RFC 1350 section 4
+			SendError(from, TFTP_EBADID, "Unknown transfer ID");
+			return true;
+		}
+
+		if(count < TFTP_HEADERSIZE)
+		{
+			// too short to be anything we would answer to
+			return true;
+		}
+
+		timeouts = 0;
+		unsigned short lastBlock = lastReceivedBlock;
+		HandleMessage(count);
+
+		// a client that resends blocks we already have didn't get our ack,
+		// and must not keep us from sending it again when the time is up
+		if(state != SESSIONSTATE_RECEIVING || lastReceivedBlock != lastBlock)
+		{
+			ResetDeadline();
+		}
+	}
+	catch(const char* exception)
+	{
+		Fail(exception);
+	}
+
+	return true;
+}
+
+// Receives the next packet, if there is one, and copies its header to
+// header. Returns -1 if there was nothing to receive.
+int TftpSession::Receive(struct sockaddr_in* from)
+{
+	if(state == SESSIONSTATE_RECEIVING)
+	{
+		PrepareStaging();
+	}
+
+	socklen_t fromlen = sizeof(*from);
+	int count = recvfrom(
+		sock,
+		received,
+		packetsize,
+		0,
+		(struct sockaddr *)from,
+		&fromlen);
+	if(count == -1)
+	{
+		if(errno != EAGAIN)
+		{
+			THROW_ERRNO("recvfrom");
+		}
+		return -1;
+	}
+	PacketTrace::Record(0, localPort, *from, received, count);
+
+	memcpy(header, received, TFTP_HEADERSIZE);
+	if(state == SESSIONSTATE_RECEIVING)
+	{
+		// the header landed on the end of the data before it
+		memcpy(received, saved, TFTP_HEADERSIZE);
+		bytesCopied += 2 * TFTP_HEADERSIZE;
+	}
+	bytesCopied += count;
+
+	// terminate error messages
+	received[count] = '\0';
+
+	return count;
+}
+
+// Makes the next packet land with its data right after the data that hasn't
+// been written yet. When the slot is full, the few bytes left are moved to
+// its start.
+void TftpSession::PrepareStaging()
+{
+	if(streamEnd + blocksize + 1 > stagingSize)
+	{
+		int length = streamEnd - streamStart;
+		memmove(staging + TFTP_STAGING_ALIGNMENT, staging + streamStart, length);
+		streamStart = TFTP_STAGING_ALIGNMENT;
+		streamEnd = streamStart + length;
+		bytesCopied += length;
+	}
+
+	received = staging + streamEnd - TFTP_HEADERSIZE;
+	memcpy(saved, received, TFTP_HEADERSIZE);
+}
+
+// Tells if the staging slot can take another block once it has been moved
+// to the start of the slot.
+bool TftpSession::HasRoom() const
+{
+	return streamEnd - streamStart + blocksize + 1 <= stagingSize - TFTP_STAGING_ALIGNMENT;
+}
+
+// Writes some of the data that has been acknowledged but is still in the
+// staging slot. Returns true if anything was written.
+bool TftpSession::WriteBehind()
+{
+	if(state != SESSIONSTATE_RECEIVING || streamEnd == streamStart)
+	{
+		return false;
+	}
+
+	int length = streamEnd - streamStart;
+	if(length > TFTP_WRITE_BEHIND_SIZE)
+	{
+		length = TFTP_WRITE_BEHIND_SIZE;
+	}
+	int written = file->WriteDirect(staging + streamStart, length);
+	streamStart += written;
+	return written > 0;
+}
+
+bool TftpSession::IsClient(const struct sockaddr_in& client) const
+{
+	return client.sin_addr.s_addr == remote.sin_addr.s_addr &&
+		client.sin_port == remote.sin_port;
+}
+
+void TftpSession::ResetDeadline()
+{
+	deadline = GetMillis() + rtt.GetTimeout();
+}
+
+// Starts measuring the round trip time until the client answers the given
+// block. Retransmissions must call StopTiming (Karn's algorithm).
+void TftpSession::StartTiming(unsigned int block)
+{
+	timing = true;
+	timedBlock = block;
+	timedSince = GetMillis();
+}
+
+void TftpSession::StopTiming(unsigned int block)
+{
+	if(timing && block == timedBlock)
+	{
+		u32 sample = GetMillis() - timedSince;
+		rtt.Sample(sample);
+		roundTrip.Record(sample);
+	}
+	timing = false;
+}
+
+void TftpSession::OpenSocket(int port)
+{
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(sock == -1) { THROW_ERRNO("socket"); }
+
+	struct sockaddr_in sain;
+	sain.sin_family = AF_INET;
+	sain.sin_port = htons(port);
+	sain.sin_addr.s_addr = INADDR_ANY;
+	int result = bind(sock, (struct sockaddr *)&sain, sizeof(sain));
+	if(result == -1)
+	{
+		int error = errno;
+		close(sock);
+		sock = -1;
+		errno = error;
+		THROW_ERRNO("bind");
+	}
+	localPort = port;
+
+	// set socket to non-blocking
+	int i = 1;
+	ioctl(sock, FIONBIO, &i);
+}
+
+void TftpSession::StartReceive()
+{
+	file = FileFactory::OpenFile(filename, true, fileStorage);
+	if(requestedOptions & TFTP_OPTION_TSIZE)
+	{
+		file->SetLength(transferSize);
+	}
+	if(requestedOptions & TFTP_OPTION_VERIFY)
+	{
+		file->SetVerify(verify);
+	}
+
+	// the staging slot starts one alignment unit into the buffer, leaving
+	// room for the header of the first packet
+	packetsize = TFTP_HEADERSIZE + blocksize;
+	stagingSize = TFTP_STAGING_SIZE;
+	staging = (char*)(((size_t)buffer + TFTP_STAGING_ALIGNMENT - 1) & ~(TFTP_STAGING_ALIGNMENT - 1));
+	streamStart = streamEnd = TFTP_STAGING_ALIGNMENT;
+	state = SESSIONSTATE_RECEIVING;
+
+	if(requestedOptions != 0)
+	{
+		oackPending = true;
+		SendOAck();
+	}
+	else
+	{
+		SendAck(0);
+	}
+	StartTiming(1);
+
+	if(requestedOptions & TFTP_OPTION_TSIZE)
+	{
+		progress.totalBytes = transferSize;
+	}
+}
+
+void TftpSession::StartSend()
+{
+	file = FileFactory::OpenFile(filename, false, fileStorage);
+	if(requestedOptions & TFTP_OPTION_TSIZE)
+	{
+		// the client asks for the size, which we leave out if we don't know
+		transferSize = file->GetLength();
+		if(transferSize == -1)
+		{
+			requestedOptions &= ~TFTP_OPTION_TSIZE;
+		}
+	}
+	// there is nothing to verify when reading
+	requestedOptions &= ~TFTP_OPTION_VERIFY;
+
+	// blocks of files that can be mapped are sent from where they are, and
+	// only need one packet to be put together in, otherwise there is one
+	// packet per block in the window. Either way one more for incoming
+	// messages.
+	int length;
+	mapped = (file->Map(0, &length) != NULL);
+	int packets = mapped ? 1 : windowsize;
+	packetsize = TFTP_HEADERSIZE + blocksize;
+	packet = buffer;
+	received = buffer + packetsize * packets;
+	state = SESSIONSTATE_SENDING;
+	progress.sending = true;
+	progress.totalBytes = file->GetLength();
+
+	if(requestedOptions != 0)
+	{
+		// the client acknowledges the options with ack 0
+		oackPending = true;
+		SendOAck();
+		StartTiming(0);
+	}
+	else
+	{
+		if(ReadWindow())
+		{
+			SendWindow();
+		}
+	}
+}
+
+void TftpSession::HandleMessage(int count)
+{
+	TftpMsg* msg = (TftpMsg*)header;
+	switch(ntohs(msg->op))
+	{
+	case TFTP_MSG_DATA:
+		if(state != SESSIONSTATE_RECEIVING)
+		{
+			THROW("Unexpected operation");
+		}
+		HandleData(ntohs(((TftpMsgData*)msg)->block), count - TFTP_HEADERSIZE);
+		break;
+
+	case TFTP_MSG_ACK:
+		if(state != SESSIONSTATE_SENDING)
+		{
+			THROW("Unexpected operation");
+		}
+		HandleAck(ntohs(((TftpMsgAck*)msg)->block));
+		break;
+
+	case TFTP_MSG_ERROR:
+		{
+			THROW(received + TFTP_HEADERSIZE);
+		}
+
+	default:
+		THROW("Unexpected operation");
+	}
+}
+
+void TftpSession::HandleData(unsigned short block, int length)
+{
+	oackPending = false;
+
+	unsigned short expectedBlock = (lastReceivedBlock + 1) & 0xFFFF;
+	if(block != expectedBlock)
+	{
+		short ahead = (short)(block - expectedBlock);
+		if(ahead > 0)
+		{
+			progress.outOfOrder++;
+			outOfOrderTotal.Increment();
+		}
+		else
+		{
+			progress.retransmits++;
+			retransmitsTotal.Increment();
+		}
+
+		// we should only send an ack if the block number is too high
+		// see http://en.wikipedia.org/wiki/Sorcerer%27s_Apprentice_Syndrome
+		// and only once per gap, since the ack makes the sender rewind
+		// its window to the block following the last one we received
+		if(ahead > 0 && !gapAcked)
+		{
+			SendAck(lastReceivedBlock);
+			blocksUnacked = 0;
+			gapAcked = true;
+		}
+
+		// the resent blocks will not tell us anything about the round trip
+		timing = false;
+		return;
+	}
+	StopTiming(expectedBlock);
+	lastReceivedBlock = expectedBlock;
+	gapAcked = false;
+
+	// the block is acknowledged once it is in the staging slot, and
+	// written from there while the next ones are received
+	streamEnd += length;
+	bytesReceived += length;
+	bytesReceivedTotal.Add(length);
+	blocksUnacked++;
+	progress.bytes = bytesReceived;
+
+	if(length != blocksize)
+	{
+		// the last ack tells the client that the file is written, so
+		// everything is written first, and a failure is sent as an error
+		file->Write(staging + streamStart, streamEnd - streamStart);
+		bytesCopied += streamEnd - streamStart;
+		streamStart = streamEnd;
+		Finish();
+	}
+
+	// one ack per window, and always for the last block
+	if(blocksUnacked == windowsize || length != blocksize)
+	{
+		writeBehind.Record(streamEnd - streamStart);
+		SendAck(lastReceivedBlock);
+		StartTiming((lastReceivedBlock + 1) & 0xFFFF);
+		blocksUnacked = 0;
+	}
+}
+
+void TftpSession::HandleAck(unsigned short block)
+{
+	if(oackPending)
+	{
+		if(block == 0)
+		{
+			StopTiming(0);
+			oackPending = false;
+			if(ReadWindow())
+			{
+				SendWindow();
+			}
+		}
+		return;
+	}
+
+	// an ack of the block before the window means the client got none of
+	// it, and as long as it keeps asking the deadline is never reached
+	unsigned short offset = block - (firstUnackedBlock & 0xFFFF);
+	if(offset == 0xFFFF)
+	{
+		SendWindow();
+		return;
+	}
+
+	// acks of anything else outside the window are stale duplicates
+	if(offset >= blocksBuffered)
+	{
+		progress.outOfOrder++;
+		outOfOrderTotal.Increment();
+		return;
+	}
+
+	int blocksAcked = offset + 1;
+	StopTiming(firstUnackedBlock + offset);
+	for(int i = 0; i < blocksAcked; i++)
+	{
+		int length = lengths[(firstUnackedBlock + i) % windowsize];
+		bytesAcked += length;
+		bytesSentTotal.Add(length);
+	}
+	firstUnackedBlock += blocksAcked;
+	blocksBuffered -= blocksAcked;
+	progress.bytes = bytesAcked;
+
+	if(lastBlockRead && blocksBuffered == 0)
+	{
+		Finish();
+		return;
+	}
+
+	// resend from the block after the acked one
+	if(ReadWindow())
+	{
+		SendWindow();
+	}
+}
+
+void TftpSession::HandleTimeout()
+{
+	if(oackPending)
+	{
+		SendOAck();
+	}
+	else if(state == SESSIONSTATE_RECEIVING)
+	{
+		SendAck(lastReceivedBlock);
+		blocksUnacked = 0;
+	}
+	else
+	{
+		SendWindow();
+	}
+}
+
+// Fills the window with the blocks after the ones buffered. Returns false
+// if the file can't be read yet, in which case Step reads the rest and
+// sends the window once it can.
+bool TftpSession::ReadWindow()
+{
+	readPending = false;
+	while(!lastBlockRead && blocksBuffered < windowsize)
+	{
+		unsigned int block = firstUnackedBlock + blocksBuffered;
+		int slot = block % windowsize;
+		if(mapped)
+		{
+			payloads[slot] = (const char*)file->Map(blocksize, &lengths[slot]);
+		}
+		else
+		{
+			char* data = buffer + slot * packetsize + TFTP_HEADERSIZE;
+			lengths[slot] = file->Read(data, blocksize);
+			if(lengths[slot] == -1)
+			{
+				readPending = true;
+				return false;
+			}
+			payloads[slot] = data;
+		}
+		lastBlockRead = (lengths[slot] != blocksize);
+		blocksBuffered++;
+	}
+	return true;
+}
+
+void TftpSession::SendWindow()
+{
+	for(int i = 0; i < blocksBuffered; i++)
+	{
+		unsigned int block = firstUnackedBlock + i;
+		int slot = block % windowsize;
+		SendDataMsg(block, payloads[slot], lengths[slot]);
+		if(block <= lastBlockSent)
+		{
+			progress.retransmits++;
+			retransmitsTotal.Increment();
+		}
+	}
+
+	// only time windows without retransmitted blocks
+	unsigned int lastBlock = firstUnackedBlock + blocksBuffered - 1;
+	if(firstUnackedBlock > lastBlockSent)
+	{
+		StartTiming(lastBlock);
+	}
+	lastBlockSent = lastBlock;
+}
+
+void TftpSession::Finish()
+{
+	file->Close();
+	FileFactory::CloseFile(file);
+	file = NULL;
+
+	if(state == SESSIONSTATE_RECEIVING)
+	{
+		printf("File received successfully.\n");
+		if(bytesReceived > 0)
+		{
+			unsigned int ratio = (unsigned int)((u64)bytesCopied * 100 / bytesReceived);
+			printf("%u.%02u bytes copied per byte written\n", ratio / 100, ratio % 100);
+		}
+	}
+	else
+	{
+		printf("File sent successfully.\n");
+	}
+
+	u32 elapsed = GetMillis() - progress.startTime;
+	transfersOk.Increment();
+	lastTransferBytes.Set(progress.bytes);
+	lastTransferMillis.Set(elapsed);
+	transferTime.Record(elapsed);
+	state = SESSIONSTATE_FINISHED;
+}
+
+void TftpSession::Fail(const char* error)
+{
+	printf("Error: %s\n", error);
+	if(sock != -1)
+	{
+		SendError(error);
+	}
+	transfersFailed.Increment();
+	state = SESSIONSTATE_FINISHED;
+}
+
+void TftpSession::SendDataMsg(unsigned int block, const char* data, int length)
+{
+	if(mapped)
+	{
+		SendGather(block, data, length);
+		return;
+	}
+
+	// blocks that were read have room for the header in front of them
+	TftpMsgData* msg = (TftpMsgData*)(data - TFTP_HEADERSIZE);
+	msg->op = htons(TFTP_MSG_DATA);
+	msg->block = htons(block & 0xFFFF);
+	PacketTrace::Record(PACKETTRACE_OUTBOUND, localPort, remote, msg, TFTP_HEADERSIZE + length);
+
+	int count = sendto(
+		sock,
+		msg,
+		TFTP_HEADERSIZE + length,
+		0,
+		(struct sockaddr *)&remote,
+		sizeof(remote));
+	if(count == -1) { THROW_ERRNO("sendto"); }
+}
+
+// Sends a header followed by data that is somewhere else, e.g. in the cart.
+void TftpSession::SendGather(unsigned int block, const char* data, int length)
+{
+#ifdef DS
+	// dswifi can't gather, so the packet is put together here, which is the
+	// only time the data is copied before the socket copies it
+	TftpMsgData* msg = (TftpMsgData*)packet;
+	msg->op = htons(TFTP_MSG_DATA);
+	msg->block = htons(block & 0xFFFF);
+	memcpy(msg->data, data, length);
+	PacketTrace::Record(PACKETTRACE_OUTBOUND, localPort, remote, msg, TFTP_HEADERSIZE + length);
+
+	int count = sendto(
+		sock,
+		msg,
+		TFTP_HEADERSIZE + length,
+		0,
+		(struct sockaddr *)&remote,
+		sizeof(remote));
+#else
+	TftpMsgData msg;
+	msg.op = htons(TFTP_MSG_DATA);
+	msg.block = htons(block & 0xFFFF);
+	PacketTrace::Record(PACKETTRACE_OUTBOUND, localPort, remote, &msg, TFTP_HEADERSIZE + length);
+
+	struct iovec iov[2];
+	iov[0].iov_base = &msg;
+	iov[0].iov_len = TFTP_HEADERSIZE;
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = length;
+
+	struct msghdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_name = &remote;
+	hdr.msg_namelen = sizeof(remote);
+	hdr.msg_iov = iov;
+	hdr.msg_iovlen = 2;
+
+	// the emulated cart of the host build only lets the data be read after
+	// the program has touched it, see host/hostflash.c, and the kernel won't
+	if(length > 0)
+	{
+		(void)*(volatile const char*)data;
+		(void)*(volatile const char*)(data + length - 1);
+	}
+	int count = sendmsg(sock, &hdr, 0);
+#endif
+	if(count == -1) { THROW_ERRNO("sendto"); }
+}
+
+void TftpSession::SendAck(int block)
+{
+	TftpMsgAck ackMsg;
+	ackMsg.op = htons(TFTP_MSG_ACK);
+	ackMsg.block = htons(block);
+	PacketTrace::Record(PACKETTRACE_OUTBOUND, localPort, remote, &ackMsg, sizeof(ackMsg));
+
+	int count = sendto(sock, &ackMsg, sizeof(ackMsg), 0, (struct sockaddr *)&remote, sizeof(remote));
+	if(count == -1) { THROW_ERRNO("sendto"); }
+}
+
+void TftpSession::SendError(const char* error)
+{
+	// TODO: curl ignores the message, so we should set the correct error code
+	SendError(remote, TFTP_EACCESS, error);
+}
+
+void TftpSession::SendError(const struct sockaddr_in& to, int code, const char* error)
+{
+	char buffer[TFTP_HEADERSIZE + TFTP_MAX_ERRORSIZE];
+	TftpMsgError* errMsg = (TftpMsgError*)buffer;
+	errMsg->op = htons(TFTP_MSG_ERROR);
+	errMsg->error = htons(code);
+	strncpy(errMsg->message, error, TFTP_MAX_ERRORSIZE - 1);
+	errMsg->message[TFTP_MAX_ERRORSIZE - 1] = '\0';
+
+	int length = TFTP_HEADERSIZE + strlen(errMsg->message) + 1;
+	PacketTrace::Record(PACKETTRACE_OUTBOUND, localPort, to, errMsg, length);
+	sendto(sock, errMsg, length, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+void TftpSession::ParseOptions(const char* options, int length)
+{
+	const char* ptr = options;
+	const char* end = ptr + length;
+	filename = ptr;
+	ptr += strlen(filename) + 1;
+	mode = ptr;
+	ptr += strlen(mode) + 1;
+	while(ptr < end)
+	{
+		const char* option = ptr;
+		ptr += strlen(option) + 1;
+		const char* value = ptr;
+		ptr += strlen(value) + 1;
+		printf("option: %s=%s\n", option, value);
+		if(strcmp(option, "blksize") == 0)
+		{
+			int size = 0;
+			sscanf(value, "%i", &size);
+			if(size >= TFTP_MIN_BLOCKSIZE)
+			{
+				// we are allowed to answer with a smaller block size, and
+				// the buffers only have room for so much
+				blocksize = (size > TFTP_MAX_BLOCKSIZE) ? TFTP_MAX_BLOCKSIZE : size;
+				requestedOptions |= TFTP_OPTION_BLKSIZE;
+			}
+		}
+		else if(strcmp(option, "windowsize") == 0)
+		{
+			int size = 0;
+			sscanf(value, "%i", &size);
+			if(size >= 1)
+			{
+				// we are allowed to answer with a smaller window
+				windowsize = (size > TFTP_MAX_WINDOWSIZE) ? TFTP_MAX_WINDOWSIZE : size;
+				requestedOptions |= TFTP_OPTION_WINDOWSIZE;
+			}
+		}
+		else if(strcmp(option, "tsize") == 0)
+		{
+			if(sscanf(value, "%i", &transferSize) == 1 && transferSize >= 0)
+			{
+				requestedOptions |= TFTP_OPTION_TSIZE;
+			}
+		}
+		else if(strcmp(option, "verify") == 0)
+		{
+			// not a standard option, so anything else is left unanswered
+			for(int i = 0; i < (int)(sizeof(verifyNames) / sizeof(verifyNames[0])); i++)
+			{
+				if(strcmp(value, verifyNames[i]) == 0)
+				{
+					verify = (VerifyPolicy)i;
+					requestedOptions |= TFTP_OPTION_VERIFY;
+				}
+			}
+		}
+	}
+}
+
+static char* AppendOption(char* ptr, const char* option, int value)
+{
+	ptr += sprintf(ptr, "%s", option) + 1;
+	ptr += sprintf(ptr, "%i", value) + 1;
+	return ptr;
+}
+
+static char* AppendOption(char* ptr, const char* option, const char* value)
+{
+	ptr += sprintf(ptr, "%s", option) + 1;
+	ptr += sprintf(ptr, "%s", value) + 1;
+	return ptr;
+}
+
+void TftpSession::SendOAck()
+{
+	char buffer[1024];
+	TftpMsgOAck* msg = (TftpMsgOAck*)buffer;
+	msg->op = htons(TFTP_MSG_OACK);
+	char* ptr = msg->options;
+	if(requestedOptions & TFTP_OPTION_BLKSIZE)
+	{
+		ptr = AppendOption(ptr, "blksize", blocksize);
+	}
+	if(requestedOptions & TFTP_OPTION_WINDOWSIZE)
+	{
+		ptr = AppendOption(ptr, "windowsize", windowsize);
+	}
+	if(requestedOptions & TFTP_OPTION_TSIZE)
+	{
+		ptr = AppendOption(ptr, "tsize", transferSize);
+	}
+	if(requestedOptions & TFTP_OPTION_VERIFY)
+	{
+		ptr = AppendOption(ptr, "verify", verifyNames[verify]);
+	}
+	PacketTrace::Record(PACKETTRACE_OUTBOUND, localPort, remote, buffer, ptr - buffer);
+
+	int count = sendto(
+		sock,
+		buffer,
+		ptr - buffer,
+		0,
+		(struct sockaddr *)&remote,
+		sizeof(remote));
+	if(count == -1) { THROW_ERRNO("sendto"); }
+}
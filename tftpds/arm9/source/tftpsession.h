@@ -0,0 +1,124 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "tftpprotocol.h"
+#include "rttestimator.h"
+#include "file.h"
+
+enum SessionState
+{
+	SESSIONSTATE_RECEIVING,
+	SESSIONSTATE_SENDING,
+	SESSIONSTATE_FINISHED
+};
+
+// What the hud shows about a transfer.
+struct SessionProgress
+{
+	bool sending;
+	u32 startTime;
+	unsigned int bytes;
+	int totalBytes; // -1 if not known
+	unsigned int retransmits;
+	unsigned int outOfOrder;
+	unsigned int timeouts;
+};
+
+// A single transfer, talking to its client from a port of its own. It is
+// a state machine driven one packet at a time by calling Step until
+// IsFinished. Step never waits for the network; if nothing arrives before
+// GetDeadline, the next Step handles the timeout.
+class TftpSession
+{
+public:
+	TftpSession(const struct sockaddr_in& client, void* storage, char* packets);
+	~TftpSession();
+
+	// Returns false if the session failed without a socket of its own to
+	// tell the client from.
+	bool Start(int port, const char* request, int length);
+	bool Step();
+	u32 GetDeadline() const { return deadline; }
+	bool IsFinished() const { return state == SESSIONSTATE_FINISHED; }
+	bool IsClient(const struct sockaddr_in& client) const;
+	const SessionProgress& GetProgress() const { return progress; }
+
+private:
+	void OpenSocket(int port);
+	void StartReceive();
+	void StartSend();
+	int Receive(struct sockaddr_in* from);
+	void PrepareStaging();
+	bool HasRoom() const;
+	bool WriteBehind();
+	void HandleMessage(int count);
+	void HandleData(unsigned short block, int length);
+	void HandleAck(unsigned short block);
+	void HandleTimeout();
+	void ResetDeadline();
+	void StartTiming(unsigned int block);
+	void StopTiming(unsigned int block);
+	bool ReadWindow();
+	void SendWindow();
+	void Finish();
+	void Fail(const char* error);
+	void SendDataMsg(unsigned int block, const char* data, int length);
+	void SendGather(unsigned int block, const char* data, int length);
+	void SendAck(int block);
+	void SendError(const char* error);
+	void SendError(const struct sockaddr_in& to, int code, const char* error);
+	void ParseOptions(const char* options, int length);
+	void SendOAck();
+
+	int sock;
+	int localPort;
+	struct sockaddr_in remote;
+	SessionState state;
+	void* fileStorage;
+	File* file;
+	char request[TFTP_MAX_REQUESTSIZE + 1];
+	const char* filename;
+	const char* mode;
+	int requestedOptions;
+	int blocksize;
+	int windowsize;
+	int transferSize;
+	VerifyPolicy verify;
+	int packetsize;
+	char* buffer;
+	char* received;
+	char header[TFTP_HEADERSIZE];
+	bool oackPending;
+	int timeouts;
+	u32 deadline;
+	RttEstimator rtt;
+	bool timing;
+	unsigned int timedBlock;
+	u32 timedSince;
+	SessionProgress progress;
+
+	// receiving
+	char* staging;
+	int stagingSize;
+	int streamStart;
+	int streamEnd;
+	char saved[TFTP_HEADERSIZE];
+	unsigned int bytesCopied;
+	unsigned short lastReceivedBlock;
+	unsigned int bytesReceived;
+	int blocksUnacked;
+	bool gapAcked;
+
+	// sending
+	bool mapped;
+	char* packet;
+	const char* payloads[TFTP_MAX_WINDOWSIZE];
+	int lengths[TFTP_MAX_WINDOWSIZE];
+	unsigned int firstUnackedBlock;
+	unsigned int lastBlockSent;
+	unsigned int bytesAcked;
+	int blocksBuffered;
+	bool lastBlockRead;
+	bool readPending;
+};
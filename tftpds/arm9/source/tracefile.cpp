@@ -0,0 +1,53 @@
+#include "platform.h"
+#include "tracefile.h"
+#include "packettrace.h"
+
+TraceFile::TraceFile(const char* filename, bool write)
+:	position(0),
+	state(FILESTATE_CLOSED)
+{
+	if(write)
+	{
+		throw "The trace is read only.";
+	}
+
+	PacketTrace::Pause();
+	position = PacketTrace::GetStart();
+	state = FILESTATE_READ;
+}
+
+TraceFile::~TraceFile()
+{
+	Close();
+}
+
+int TraceFile::Read(void* dest, int length)
+{
+	if(state != FILESTATE_READ)
+	{
+		throw "Illegal state.";
+	}
+
+	int count = PacketTrace::Copy(position, dest, length);
+	position += count;
+	return count;
+}
+
+void TraceFile::Write(void* source, int length)
+{
+	throw "The trace is read only.";
+}
+
+void TraceFile::Close()
+{
+	if(state != FILESTATE_CLOSED)
+	{
+		PacketTrace::Resume();
+		state = FILESTATE_CLOSED;
+	}
+}
+
+int TraceFile::GetLength()
+{
+	return PacketTrace::GetEnd() - PacketTrace::GetStart();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "file.h"
+#include "platform.h"
+
+// The packet trace as a read only file. Recording is paused from when it
+// is opened until it is closed.
+class TraceFile : public File
+{
+public:
+	TraceFile(const char* filename, bool write);
+	virtual ~TraceFile();
+
+	virtual int Read(void* dest, int length);
+	virtual void Write(void* source, int length);
+	virtual void Close();
+	virtual int GetLength();
+
+private:
+	u32 position;
+	FileState state;
+};
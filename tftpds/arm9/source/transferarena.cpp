@@ -0,0 +1,44 @@
+#include "tftpsession.h"
+#include "transferarena.h"
+#include "filefactory.h"
+
+#include "platform.h"
+
+#define ARENA_ALIGN(x) (((x) + TFTP_STAGING_ALIGNMENT - 1) & ~(TFTP_STAGING_ALIGNMENT - 1))
+
+// every part of a slot starts on a staging alignment boundary
+#define ARENA_SESSION_SIZE ARENA_ALIGN(sizeof(TftpSession))
+#define ARENA_FILE_SIZE ARENA_ALIGN(FILEFACTORY_STORAGE_SIZE)
+#define ARENA_BUFFER_SIZE ARENA_ALIGN(TFTP_SESSION_BUFFER_SIZE)
+#define ARENA_SLOT_SIZE (ARENA_SESSION_SIZE + ARENA_FILE_SIZE + ARENA_BUFFER_SIZE)
+
+// the staging slot and the header in front of it must fit in the buffer
+typedef char StagingFitsInBuffer[
+	TFTP_STAGING_SIZE + TFTP_STAGING_ALIGNMENT - 1 <= TFTP_SESSION_BUFFER_SIZE &&
+	TFTP_STAGING_ALIGNMENT * 2 + TFTP_MAX_BLOCKSIZE + 1 <= TFTP_STAGING_SIZE ? 1 : -1];
+
+TransferArena::TransferArena()
+{
+	memory = new char[ARENA_SLOT_SIZE * TFTP_MAX_SESSIONS + TFTP_STAGING_ALIGNMENT - 1];
+	base = (char*)ARENA_ALIGN((size_t)memory);
+}
+
+TransferArena::~TransferArena()
+{
+	delete[] memory;
+}
+
+void* TransferArena::GetSession(int slot)
+{
+	return base + slot * ARENA_SLOT_SIZE;
+}
+
+void* TransferArena::GetFile(int slot)
+{
+	return base + slot * ARENA_SLOT_SIZE + ARENA_SESSION_SIZE;
+}
+
+char* TransferArena::GetBuffer(int slot)
+{
+	return base + slot * ARENA_SLOT_SIZE + ARENA_SESSION_SIZE + ARENA_FILE_SIZE;
+}
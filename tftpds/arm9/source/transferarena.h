@@ -0,0 +1,21 @@
+#pragma once
+
+#include "tftpprotocol.h"
+
+// Memory for the transfers, set aside once when the server starts so that
+// transfers don't allocate from the heap that is shared with dswifi. Slot i
+// has room for a session, its file and its packet buffer.
+class TransferArena
+{
+public:
+	TransferArena();
+	~TransferArena();
+
+	void* GetSession(int slot);
+	void* GetFile(int slot);
+	char* GetBuffer(int slot);
+
+private:
+	char* memory;
+	char* base;
+};
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include "transferhud.h"
+#include "clock.h"
+
+#define HUD_SAMPLE_INTERVAL 500
+
+TransferHud::TransferHud(const TftpServer& server)
+:	server(server),
+	lastFrame(-1),
+	shown(false)
+{
+	for(int i = 0; i < TFTP_MAX_SESSIONS; i++)
+	{
+		drawn[i] = false;
+		sessionStart[i] = 0;
+		sampleTime[i] = 0;
+		sampleBytes[i] = 0;
+		rate[i] = 0;
+	}
+}
+
+void TransferHud::SetupConsole()
+{
+	printf("\e[%i;0H", HUD_ROWS);
+}
+
+bool TransferHud::Step()
+{
+	int frame = Scheduler::GetFrameCount();
+	if(frame == lastFrame)
+	{
+		return false;
+	}
+	lastFrame = frame;
+
+	bool active = false;
+	for(int i = 0; i < TFTP_MAX_SESSIONS; i++)
+	{
+		const TftpSession* session = server.GetSession(i);
+		active = active || (session != NULL && !session->IsFinished());
+	}
+	if(!active && !shown)
+	{
+		return false;
+	}
+
+	// The log scrolls the whole console, so anything it pushed up into the
+	// rows of the hud is written over, idle slots included. The cursor is
+	// saved, so that the log carries on where it was.
+	u32 now = GetMillis();
+	printf("\e[s");
+	for(int i = 0; i < TFTP_MAX_SESSIONS; i++)
+	{
+		const TftpSession* session = server.GetSession(i);
+		if(session != NULL && !session->IsFinished())
+		{
+			Draw(i, session->GetProgress(), now);
+		}
+		else
+		{
+			Clear(i);
+		}
+	}
+	printf("\e[u");
+	shown = active;
+
+	return false;
+}
+
+void TransferHud::Draw(int slot, const SessionProgress& progress, u32 now)
+{
+	if(!drawn[slot] || sessionStart[slot] != progress.startTime)
+	{
+		// a new session in this slot
+		sessionStart[slot] = progress.startTime;
+		sampleTime[slot] = progress.startTime;
+		sampleBytes[slot] = 0;
+		rate[slot] = 0;
+	}
+
+	u32 elapsed = now - sampleTime[slot];
+	if(elapsed >= HUD_SAMPLE_INTERVAL)
+	{
+		rate[slot] = (u32)((u64)(progress.bytes - sampleBytes[slot]) * 1000 / elapsed);
+		sampleTime[slot] = now;
+		sampleBytes[slot] = progress.bytes;
+	}
+
+	u32 total = now - progress.startTime;
+	unsigned int average = (total > 0) ? (u32)((u64)progress.bytes * 1000 / total) : 0;
+
+	char eta[8] = "--:--";
+	if(progress.totalBytes >= 0 && average > 0)
+	{
+		unsigned int seconds = (progress.totalBytes - progress.bytes) / average;
+		if(seconds < 100 * 60)
+		{
+			sprintf(eta, "%2u:%02u", seconds / 60, seconds % 60);
+		}
+	}
+
+	printf("\e[%i;0H%c %6uk %4uk/s avg %4uk/s\e[0K",
+		slot * 2,
+		progress.sending ? 'S' : 'R',
+		progress.bytes >> 10,
+		rate[slot] >> 10,
+		average >> 10);
+	printf("\e[%i;0H  eta %s re %u ooo %u to %u\e[0K",
+		slot * 2 + 1,
+		eta,
+		progress.retransmits,
+		progress.outOfOrder,
+		progress.timeouts);
+	drawn[slot] = true;
+}
+
+void TransferHud::Clear(int slot)
+{
+	printf("\e[%i;0H\e[0K\e[%i;0H\e[0K", slot * 2, slot * 2 + 1);
+	drawn[slot] = false;
+}
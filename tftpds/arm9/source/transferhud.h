@@ -0,0 +1,39 @@
+#pragma once
+
+#include <nds.h>
+#include "scheduler.h"
+#include "tftpserver.h"
+#include "tftpsession.h"
+
+// two lines per session
+#define HUD_ROWS (TFTP_MAX_SESSIONS * 2)
+
+// Shows the progress of the transfers in the top rows of the console, two
+// lines per session. It is redrawn at most once per frame, so the transfers
+// don't pay for printing.
+class TransferHud : public Task
+{
+public:
+	TransferHud(const TftpServer& server);
+
+	// Starts the log below the rows of the hud. Call before anything is
+	// printed.
+	static void SetupConsole();
+
+	virtual bool Step();
+
+private:
+	void Draw(int slot, const SessionProgress& progress, u32 now);
+	void Clear(int slot);
+
+	const TftpServer& server;
+	int lastFrame;
+	bool shown;
+	bool drawn[TFTP_MAX_SESSIONS];
+
+	// the instant rate is measured over a few hundred milliseconds
+	u32 sessionStart[TFTP_MAX_SESSIONS];
+	u32 sampleTime[TFTP_MAX_SESSIONS];
+	unsigned int sampleBytes[TFTP_MAX_SESSIONS];
+	unsigned int rate[TFTP_MAX_SESSIONS];
+};
@@ -6,20 +6,8 @@
 #include <gba_input.h>
 #include <stdio.h>
 #include <string.h>
-
-static const unsigned char nintendo_logo[] =
-{
-	0x24,0xFF,0xAE,0x51,0x69,0x9A,0xA2,0x21,0x3D,0x84,0x82,0x0A,0x84,0xE4,0x09,0xAD,
-	0x11,0x24,0x8B,0x98,0xC0,0x81,0x7F,0x21,0xA3,0x52,0xBE,0x19,0x93,0x09,0xCE,0x20,
-	0x10,0x46,0x4A,0x4A,0xF8,0x27,0x31,0xEC,0x58,0xC7,0xE8,0x33,0x82,0xE3,0xCE,0xBF,
-	0x85,0xF4,0xDF,0x94,0xCE,0x4B,0x09,0xC1,0x94,0x56,0x8A,0xC0,0x13,0x72,0xA7,0xFC,
-	0x9F,0x84,0x4D,0x73,0xA3,0xCA,0x9A,0x61,0x58,0x97,0xA3,0x27,0xFC,0x03,0x98,0x76,
-	0x23,0x1D,0xC7,0x61,0x03,0x04,0xAE,0x56,0xBF,0x38,0x84,0x00,0x40,0xA7,0x0E,0xFD,
-	0xFF,0x52,0xFE,0x03,0x6F,0x95,0x30,0xF1,0x97,0xFB,0xC0,0x85,0x60,0xD6,0x80,0x25,
-	0xA9,0x63,0xBE,0x03,0x01,0x4E,0x38,0xE2,0xF9,0xA2,0x34,0xFF,0xBB,0x3E,0x03,0x44,
-	0x78,0x00,0x90,0xCB,0x88,0x11,0x3A,0x94,0x65,0xC0,0x7C,0x63,0x87,0xF0,0x3C,0xAF,
-	0xD6,0x25,0xE4,0x8B,0x38,0x0A,0xAC,0x72,0x21,0xD4,0xF8,0x07,
-};
+#include "catalogformat.h"
+#include "nintendologo.h"
 
 struct BootItem
 {
@@ -32,31 +20,76 @@ BootItem items[MAX_ITEMS];
 int itemCount = 0;
 int selectedItem = 0;
 
+bool IsGba(char* ptr)
+{
+	return strncmp("PASS", ptr+0xAC, 4) != 0 &&
+		memcmp(nintendo_logo, ptr+0x4, sizeof(nintendo_logo)) == 0;
+}
 
-void ScanItems()
+// keeps the items in order, and the first ones if there are too many
+void AddItem(char* ptr)
 {
-	char* ptr = (char*)0x8000000;
-	itemCount = 0;
-	while(itemCount < MAX_ITEMS && ptr < (char*)0xA000000)
+	int i = itemCount;
+	while(i > 0 && items[i-1].address > ptr - 0x8000000)
 	{
-		bool isds = false;
-		bool isgba = false;
-		if(strncmp("PASS", ptr+0xAC, 4) == 0)
+		if(i < MAX_ITEMS)
 		{
-			isds = true;
+			items[i] = items[i-1];
 		}
+		i--;
+	}
+	if(i == MAX_ITEMS)
+	{
+		return;
+	}
+
+	strncpy(items[i].title, ptr+0xA0, 12);
+	items[i].title[12] = '\0';
+	items[i].address = ptr - 0x8000000;
+	if(itemCount < MAX_ITEMS)
+	{
+		itemCount++;
+	}
+}
 
-		if(memcmp(nintendo_logo, ptr+0x4, sizeof(nintendo_logo)) == 0)
+// Returns false if there is no catalog.
+bool ReadCatalog()
+{
+	char* catalog = (char*)0x8000000 + CATALOG_OFFSET;
+	CatalogHeader* header = (CatalogHeader*)catalog;
+	if(memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != CATALOG_VERSION)
+	{
+		return false;
+	}
+
+	CatalogEntry* entries = (CatalogEntry*)(catalog + CATALOG_ENTRY_SIZE);
+	for(int i = 0; i < CATALOG_MAX_ENTRIES && entries[i].offset != CATALOG_UNUSED; i++)
+	{
+		u32 offset = entries[i].offset;
+		if(entries[i].replaced == CATALOG_UNUSED && offset < CATALOG_OFFSET &&
+			(offset & (CATALOG_SIZE - 1)) == 0 && IsGba((char*)0x8000000 + offset))
 		{
-			isgba = true;
+			AddItem((char*)0x8000000 + offset);
 		}
-		
-		if(isgba && !isds)
+	}
+	return true;
+}
+
+void ScanItems()
+{
+	itemCount = 0;
+	if(ReadCatalog())
+	{
+		return;
+	}
+
+	char* ptr = (char*)0x8000000;
+	while(itemCount < MAX_ITEMS && ptr < (char*)0xA000000)
+	{
+		if(IsGba(ptr))
 		{
-			strncpy(items[itemCount].title, ptr+0xA0, 12);
-			items[itemCount].title[12] = '\0';
-			items[itemCount].address = ptr - 0x8000000;
-			itemCount++;
+			AddItem(ptr);
 		}
 
 		ptr += 0x40000;
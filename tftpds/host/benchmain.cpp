@@ -0,0 +1,694 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include "tftpserver.h"
+#include "tftpclient.h"
+#include "statsfile.h"
+#include "clock.h"
+#include "platform.h"
+#include "hostflash.h"
+#include "hostipc.h"
+#include "flashengine.h"
+#include "lzfile.h"
+
+#define BENCH_TIMEOUT 100
+#define BENCH_RUN_LIMIT 120000
+#define BENCH_MAX_ROWS 64
+#define BENCH_KEYSIZE 64
+#define BENCH_MAX_REPEATS 9
+// how much slower than the baseline a run can be besides the tolerance,
+// for runs too short for a percentage to mean anything
+#define BENCH_NOISE_MS 20
+// where the compressed streams are checked, out of the way of the runs
+#define BENCH_LZ_OFFSET 0x1000000
+
+// The server's counters that a run is compared by.
+struct ServerStats
+{
+	unsigned int ok;
+	unsigned int retransmits;
+	unsigned int outOfOrder;
+	unsigned int timeouts;
+};
+
+struct Result
+{
+	char key[BENCH_KEYSIZE];
+	const char* direction;
+	int blocksize;
+	int windowsize;
+	int size;
+	const char* network;
+	bool ok;
+	unsigned int millis;
+	unsigned int kbps;
+	unsigned int clientRetransmits;
+	unsigned int clientTimeouts;
+	ServerStats server;
+};
+
+struct Network
+{
+	const char* name;
+	Impairment impairment;
+	int repeats;
+};
+
+static const int blocksizes[] = { 512, 1432 };
+static const int windowsizes[] = { 1, 8 };
+static const int sizes[] = { 0x40000, 0x100000 };
+static const Network networks[] =
+{
+	{ "clean", { 0, 0, 0, 0 }, 5 },
+	{ "lossy", { 2, 1, 2, 1 }, 1 },
+};
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+static Result results[BENCH_MAX_ROWS];
+static int resultCount = 0;
+static FILE* report = stdout;
+
+// The server's statistics, read the way a client would read /stats/.
+static void ReadStats(ServerStats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	StatsFile file("all", false);
+	char text[4096];
+	int length = 0;
+	int count;
+	while((count = file.Read(text + length, sizeof(text) - 1 - length)) > 0)
+	{
+		length += count;
+		text[length] = '\0';
+		char* end;
+		while((end = strchr(text, '\n')) != NULL)
+		{
+			*end = '\0';
+			char name[METRIC_MAX_LINELENGTH + 1];
+			unsigned int value;
+			if(sscanf(text, "%80s %u", name, &value) == 2)
+			{
+				if(strcmp(name, "tftp_transfers_ok") == 0) stats->ok = value;
+				else if(strcmp(name, "tftp_retransmits") == 0) stats->retransmits = value;
+				else if(strcmp(name, "tftp_out_of_order") == 0) stats->outOfOrder = value;
+				else if(strcmp(name, "tftp_timeouts") == 0) stats->timeouts = value;
+			}
+			length -= end + 1 - text;
+			memmove(text, end + 1, length + 1);
+		}
+	}
+	file.Close();
+}
+
+// Different for each put, so that none of it is already on the cart and
+// left alone, and the same for the get after it.
+static void FillData(char* data, int size, int puts)
+{
+	unsigned int random = size + puts;
+	for(int i = 0; i < size; i++)
+	{
+		random = random * 1103515245 + 12345;
+		data[i] = random >> 16;
+	}
+}
+
+// Compresses source with LZ77 the greedy way, taking the last place the
+// next 3 bytes were seen if it is close enough. Returns the length.
+static int Compress(char* data, const char* source, int size)
+{
+	static int seen[0x10000];
+	memset(seen, 0xFF, sizeof(seen));
+
+	int length = 0;
+	data[length++] = 0x10;
+	data[length++] = size;
+	data[length++] = size >> 8;
+	data[length++] = size >> 16;
+	int flagsAt = 0;
+	int tokens = 0;
+	int i = 0;
+	while(i < size)
+	{
+		if(tokens % 8 == 0)
+		{
+			flagsAt = length;
+			data[length++] = 0;
+		}
+		tokens++;
+
+		int match = 0;
+		int from = -1;
+		if(i + 3 <= size)
+		{
+			const u8* key = (const u8*)source + i;
+			int hash = ((key[0] << 8) | key[1]) ^ (key[2] << 4);
+			from = seen[hash];
+			seen[hash] = i;
+			while(from != -1 && i - from <= LZFILE_WINDOW_SIZE && match < 18 &&
+				i + match < size && source[from + match] == source[i + match])
+			{
+				match++;
+			}
+		}
+
+		if(match >= 3)
+		{
+			int distance = i - from - 1;
+			data[flagsAt] |= 0x80 >> ((tokens - 1) % 8);
+			data[length++] = ((match - 3) << 4) | (distance >> 8);
+			data[length++] = distance;
+			i += match;
+		}
+		else
+		{
+			data[length++] = source[i++];
+		}
+	}
+	return length;
+}
+
+// A hand put together stream of literals and references, with what it
+// decompresses to.
+struct LzStream
+{
+	u8 data[0x4000];
+	int length;
+	u8 expected[0x4000];
+	int produced;
+	int flagsAt;
+	int tokens;
+};
+
+static void LzStart(LzStream* stream, int outputLength)
+{
+	stream->data[0] = 0x10;
+	stream->data[1] = outputLength;
+	stream->data[2] = outputLength >> 8;
+	stream->data[3] = outputLength >> 16;
+	stream->length = 4;
+	stream->produced = 0;
+	stream->tokens = 0;
+}
+
+static void LzToken(LzStream* stream, bool reference)
+{
+	if(stream->tokens % 8 == 0)
+	{
+		stream->flagsAt = stream->length;
+		stream->data[stream->length++] = 0;
+	}
+	if(reference)
+	{
+		stream->data[stream->flagsAt] |= 0x80 >> (stream->tokens % 8);
+	}
+	stream->tokens++;
+}
+
+static void LzLiterals(LzStream* stream, int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		LzToken(stream, false);
+		u8 literal = stream->produced * 7 + stream->produced / 251;
+		stream->data[stream->length++] = literal;
+		stream->expected[stream->produced++] = literal;
+	}
+}
+
+static void LzReference(LzStream* stream, int count, int distance)
+{
+	LzToken(stream, true);
+	stream->data[stream->length++] = ((count - 3) << 4) | ((distance - 1) >> 8);
+	stream->data[stream->length++] = distance - 1;
+	for(int i = 0; i < count; i++, stream->produced++)
+	{
+		stream->expected[stream->produced] = stream->expected[stream->produced - distance];
+	}
+}
+
+// Writes stream to the cart through an LzFile, a few bytes at a time like
+// a session would, and checks that outputLength bytes of what it
+// decompresses to are there.
+static bool CheckLzStream(const char* name, const LzStream& stream, int outputLength)
+{
+	char filename[64];
+	sprintf(filename, "%x/%s.lz", BENCH_LZ_OFFSET, name);
+	// not on the stack, which is out of reach of the 32 bit addresses the
+	// cart is programmed from
+	LzFile* file = NULL;
+	try
+	{
+		file = new LzFile(filename, true);
+		u8* data = (u8*)stream.data;
+		int left = stream.length;
+		while(left > 0)
+		{
+			int written = file->WriteDirect(data, left < 100 ? left : 100);
+			data += written;
+			left -= written;
+			file->Step();
+		}
+		file->Close();
+		delete file;
+	}
+	catch(const char* exception)
+	{
+		delete file;
+		fprintf(report, "lz %s: %s\n", name, exception);
+		return false;
+	}
+
+	if(memcmp(CART_BASE + BENCH_LZ_OFFSET, stream.expected, outputLength) != 0)
+	{
+		fprintf(report, "lz %s: wrong data\n", name);
+		return false;
+	}
+	fprintf(report, "lz %s ok\n", name);
+	return true;
+}
+
+// References across the edges of the window, and at the end of the file,
+// which the runs over the network may not have.
+static bool CheckLz()
+{
+	static LzStream stream;
+	bool ok = true;
+
+	// the last reference goes past the end of the window
+	LzStart(&stream, 4100);
+	LzLiterals(&stream, 4090);
+	LzReference(&stream, 10, 100);
+	ok = CheckLzStream("end", stream, 4100) && ok;
+
+	// repeats of the byte before across one edge and from as far back as
+	// can be across the next, which the length cuts short, so that the
+	// reference after it and the zeros are padding
+	LzStart(&stream, 8200);
+	LzLiterals(&stream, 4094);
+	LzReference(&stream, 18, 1);
+	LzLiterals(&stream, 4075);
+	LzReference(&stream, 18, LZFILE_WINDOW_SIZE);
+	LzReference(&stream, 18, 7);
+	stream.data[stream.length++] = 0;
+	stream.data[stream.length++] = 0;
+	ok = CheckLzStream("edges", stream, 8200) && ok;
+
+	return ok;
+}
+
+// direction is "put" or "get", or "lzput" to write what the put before
+// wrote, with a few bytes changed, to the same place as a compressed file,
+// and "lzget" to read that back.
+static void Run(TftpServer& server, int port, const char* direction, int blocksize, int windowsize, int size, const Network& network, unsigned int seed)
+{
+	bool put = (strcmp(direction, "put") == 0 || strcmp(direction, "lzput") == 0);
+	bool lz = (strcmp(direction, "lzput") == 0 || strcmp(direction, "lzget") == 0);
+	Result& result = results[resultCount++];
+	result.direction = direction;
+	result.blocksize = blocksize;
+	result.windowsize = windowsize;
+	result.size = size;
+	result.network = network.name;
+	snprintf(result.key, sizeof(result.key), "%s,%i,%i,%i,%s",
+		result.direction, blocksize, windowsize, size, network.name);
+
+	static int puts = 0;
+	if(put && !lz)
+	{
+		puts++;
+	}
+	int length = size;
+	char* data = (char*)malloc(size + size / 8 + 5);
+	char* expected = (char*)malloc(size);
+	FillData(expected, size, puts);
+	if(lz)
+	{
+		expected[size / 3] ^= 0xFF;
+		expected[size / 2] ^= 0xFF;
+		// and a few runs repeated, across the edges of the window and at
+		// the end, for the compressor to find
+		for(int i = LZFILE_WINDOW_SIZE * 15 - 5; i + 10 <= size; i += LZFILE_WINDOW_SIZE * 16)
+		{
+			memcpy(expected + i, expected + i - 100, 10);
+		}
+		memcpy(expected + size - 10, expected + size - 200, 10);
+	}
+	if(put && lz)
+	{
+		length = Compress(data, expected, size);
+	}
+	else if(put)
+	{
+		memcpy(data, expected, size);
+	}
+	else
+	{
+		memset(data, 0, size);
+	}
+
+	// the end of the cart, so that reading stops after size bytes
+	char filename[64];
+	sprintf(filename, "/rom/%x/bench%s", 0x2000000 - size, (put && lz) ? ".lz" : "");
+
+	ServerStats before;
+	ReadStats(&before);
+
+	// runs that are over in a few ms are repeated, and the median taken,
+	// so that a busy machine or the odd ms of the clock matter less
+	unsigned int times[BENCH_MAX_REPEATS];
+	int repeats = 0;
+	bool ok = true;
+	result.clientRetransmits = 0;
+	result.clientTimeouts = 0;
+	while(ok && repeats < network.repeats)
+	{
+		ServerStats started;
+		ReadStats(&started);
+
+		TftpClient client(network.impairment, seed, BENCH_TIMEOUT);
+		u32 start = GetMillis();
+		if(put)
+		{
+			client.Put(port, filename, data, length, blocksize, windowsize);
+		}
+		else
+		{
+			client.Get(port, filename, data, size, blocksize, windowsize);
+		}
+
+		ok = false;
+		while(true)
+		{
+			bool progress = server.Step();
+			progress |= client.Step();
+			if(client.IsFailed())
+			{
+				fprintf(report, "%s: %s\n", result.key, client.GetError());
+				break;
+			}
+			if(!server.IsBusy())
+			{
+				if(client.IsFinished())
+				{
+					ok = true;
+					break;
+				}
+				if(client.IsAwaitingLastAck())
+				{
+					// the server finished, but its last ack was dropped
+					ServerStats now;
+					ReadStats(&now);
+					if(now.ok != started.ok)
+					{
+						ok = true;
+						break;
+					}
+				}
+			}
+			if(!CLOCK_BEFORE(GetMillis(), start + BENCH_RUN_LIMIT))
+			{
+				fprintf(report, "%s: run took too long\n", result.key);
+				break;
+			}
+			if(!progress)
+			{
+				usleep(50);
+			}
+		}
+		times[repeats++] = GetMillis() - start;
+		result.clientRetransmits += client.GetRetransmits();
+		result.clientTimeouts += client.GetTimeouts();
+
+		if(ok && !put && (client.GetLength() != size || memcmp(data, expected, size) != 0))
+		{
+			fprintf(report, "%s: wrong data\n", result.key);
+			ok = false;
+		}
+	}
+
+	for(int i = 1; i < repeats; i++)
+	{
+		for(int j = i; j > 0 && times[j - 1] > times[j]; j--)
+		{
+			unsigned int t = times[j];
+			times[j] = times[j - 1];
+			times[j - 1] = t;
+		}
+	}
+	result.millis = times[repeats / 2];
+
+	ServerStats after;
+	ReadStats(&after);
+	result.ok = ok;
+	result.kbps = ok ? (unsigned int)((long long)size * 1000 / 1024 / (result.millis ? result.millis : 1)) : 0;
+	result.server.ok = after.ok - before.ok;
+	result.server.retransmits = after.retransmits - before.retransmits;
+	result.server.outOfOrder = after.outOfOrder - before.outOfOrder;
+	result.server.timeouts = after.timeouts - before.timeouts;
+
+	fprintf(report, "%-36s %s %6u ms %7u kB/s  resent %u/%u  timeouts %u/%u\n",
+		result.key, ok ? "ok  " : "FAIL", result.millis, result.kbps,
+		result.clientRetransmits, result.server.retransmits,
+		result.clientTimeouts, result.server.timeouts);
+
+	free(data);
+	free(expected);
+}
+
+static void WriteCsv(const char* filename)
+{
+	FILE* f = fopen(filename, "w");
+	if(f == NULL)
+	{
+		perror(filename);
+		exit(1);
+	}
+	fprintf(f, "direction,blocksize,windowsize,size,network,ok,ms,kbps,"
+		"client_retransmits,client_timeouts,server_retransmits,server_out_of_order,server_timeouts\n");
+	for(int i = 0; i < resultCount; i++)
+	{
+		const Result& r = results[i];
+		fprintf(f, "%s,%i,%u,%u,%u,%u,%u,%u,%u\n",
+			r.key, r.ok, r.millis, r.kbps,
+			r.clientRetransmits, r.clientTimeouts,
+			r.server.retransmits, r.server.outOfOrder, r.server.timeouts);
+	}
+	fclose(f);
+}
+
+static void WriteJson(const char* filename)
+{
+	FILE* f = fopen(filename, "w");
+	if(f == NULL)
+	{
+		perror(filename);
+		exit(1);
+	}
+	fprintf(f, "[\n");
+	for(int i = 0; i < resultCount; i++)
+	{
+		const Result& r = results[i];
+		fprintf(f, "  {\"direction\": \"%s\", \"blocksize\": %i, \"windowsize\": %i, "
+			"\"size\": %i, \"network\": \"%s\", \"ok\": %s, \"ms\": %u, \"kbps\": %u, "
+			"\"client_retransmits\": %u, \"client_timeouts\": %u, "
+			"\"server_retransmits\": %u, \"server_out_of_order\": %u, \"server_timeouts\": %u}%s\n",
+			r.direction, r.blocksize, r.windowsize, r.size, r.network,
+			r.ok ? "true" : "false", r.millis, r.kbps,
+			r.clientRetransmits, r.clientTimeouts,
+			r.server.retransmits, r.server.outOfOrder, r.server.timeouts,
+			i + 1 < resultCount ? "," : "");
+	}
+	fprintf(f, "]\n");
+	fclose(f);
+}
+
+// Returns the number of runs that got slower than the baseline by more
+// than tolerance percent and BENCH_NOISE_MS, or that failed.
+static int Compare(const char* filename, int tolerance)
+{
+	FILE* f = fopen(filename, "r");
+	if(f == NULL)
+	{
+		perror(filename);
+		exit(1);
+	}
+
+	int regressions = 0;
+	char line[256];
+	fgets(line, sizeof(line), f);
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		// the key is the first five fields
+		char* end = line;
+		for(int field = 0; field < 5 && end != NULL; field++)
+		{
+			end = strchr(end + 1, ',');
+		}
+		if(end == NULL)
+		{
+			continue;
+		}
+		*end = '\0';
+		int ok;
+		unsigned int millis, kbps, resent;
+		if(sscanf(end + 1, "%i,%u,%u,%u", &ok, &millis, &kbps, &resent) != 4)
+		{
+			continue;
+		}
+
+		for(int i = 0; i < resultCount; i++)
+		{
+			const Result& r = results[i];
+			if(strcmp(r.key, line) != 0)
+			{
+				continue;
+			}
+			int change = kbps ? (int)(((long long)r.kbps - kbps) * 100 / kbps) : 0;
+			bool worse = !r.ok || r.millis > millis + millis * tolerance / 100 + BENCH_NOISE_MS;
+			if(worse)
+			{
+				regressions++;
+			}
+			fprintf(report, "%-36s %7u -> %7u kB/s (%+i%%)  resent %u -> %u%s\n",
+				line, kbps, r.kbps, change, resent, r.clientRetransmits,
+				worse ? "  REGRESSION" : "");
+		}
+	}
+	fclose(f);
+	return regressions;
+}
+
+// Runs the server against a scripted client on loopback, for every
+// combination of blocksize, windowsize, transfer size and network, and
+// reports throughput and retransmissions.
+int main(int argc, char** argv)
+{
+	int port = 7070;
+	const char* csv = NULL;
+	const char* json = NULL;
+	const char* baseline = NULL;
+	int tolerance = 25;
+	int pacing = FLASH_FAST_PACING;
+	bool verbose = false;
+	bool arm7 = false;
+	int opt;
+	while((opt = getopt(argc, argv, "p:o:j:b:t:sv7")) != -1)
+	{
+		switch(opt)
+		{
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'o':
+			csv = optarg;
+			break;
+		case 'j':
+			json = optarg;
+			break;
+		case 'b':
+			baseline = optarg;
+			break;
+		case 't':
+			tolerance = atoi(optarg);
+			break;
+		case 's':
+			pacing = 1;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case '7':
+			arm7 = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-o csv] [-j json] [-b baseline csv] [-t tolerance] [-s] [-7] [-v]\n", argv[0]);
+			fprintf(stderr, "  -t  how many percent slower than the baseline is a regression (25)\n");
+			fprintf(stderr, "  -s  make the flash as slow as on a real cart\n");
+			fprintf(stderr, "  -7  program the flash from a thread, like the ARM7 does\n");
+			fprintf(stderr, "  -v  show what the server prints\n");
+			return 1;
+		}
+	}
+
+	mallopt(M_MMAP_MAX, 0);
+	if(!verbose)
+	{
+		// the server talks on stdout, so the report goes elsewhere
+		report = fdopen(dup(1), "w");
+		freopen("/dev/null", "w", stdout);
+	}
+	setvbuf(report, NULL, _IOLBF, 0);
+
+	MapCart(NULL);
+	SetFlashPacing(pacing);
+	StartClock();
+	if(arm7)
+	{
+		StartArm7();
+		FlashEngine::UseArm7(true);
+	}
+
+	int failures = 0;
+	try
+	{
+		if(!CheckLz())
+		{
+			failures++;
+		}
+
+		TftpServer server(port);
+		unsigned int seed = 1;
+		for(int n = 0; n < COUNT(networks); n++)
+		{
+			for(int s = 0; s < COUNT(sizes); s++)
+			for(int b = 0; b < COUNT(blocksizes); b++)
+			for(int w = 0; w < COUNT(windowsizes); w++)
+			{
+				// the get reads back what the put wrote
+				Run(server, port, "put", blocksizes[b], windowsizes[w], sizes[s], networks[n], seed++);
+				Run(server, port, "get", blocksizes[b], windowsizes[w], sizes[s], networks[n], seed++);
+			}
+
+			// a compressed file over the last put, which it mostly
+			// matches, so that with unchanged blocks skipped the cart
+			// only takes part of the window at a time, with references
+			// for the runs repeated in it
+			int last = sizes[COUNT(sizes) - 1];
+			FlashCartFile::UseDelta(true);
+			Run(server, port, "lzput", blocksizes[COUNT(blocksizes) - 1], windowsizes[COUNT(windowsizes) - 1], last, networks[n], seed++);
+			Run(server, port, "lzget", blocksizes[COUNT(blocksizes) - 1], windowsizes[COUNT(windowsizes) - 1], last, networks[n], seed++);
+			FlashCartFile::UseDelta(false);
+		}
+	}
+	catch(const char* exception)
+	{
+		fprintf(report, "\n*** Exception\n%s\n", exception);
+		return 1;
+	}
+
+	if(csv != NULL)
+	{
+		WriteCsv(csv);
+	}
+	if(json != NULL)
+	{
+		WriteJson(json);
+	}
+
+	for(int i = 0; i < resultCount; i++)
+	{
+		if(!results[i].ok)
+		{
+			failures++;
+		}
+	}
+	if(baseline != NULL)
+	{
+		fprintf(report, "\nCompared to %s:\n", baseline);
+		failures += Compare(baseline, tolerance);
+	}
+	return failures == 0 ? 0 : 1;
+}
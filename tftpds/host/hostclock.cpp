@@ -0,0 +1,45 @@
+#include <time.h>
+#include "clock.h"
+#include "hostclock.h"
+
+static struct timespec start;
+static bool virtualClock = false;
+static u64 virtualNanos = 0;
+
+void StartClock()
+{
+	clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+void UseVirtualClock()
+{
+	virtualClock = true;
+	virtualNanos = 0;
+}
+
+void AdvanceClock(u32 micros)
+{
+	virtualNanos += (u64)micros * 1000;
+}
+
+static u64 GetNanos()
+{
+	if(virtualClock)
+	{
+		return virtualNanos;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)(now.tv_sec - start.tv_sec) * 1000000000 + now.tv_nsec - start.tv_nsec;
+}
+
+u32 GetMillis()
+{
+	return (u32)(GetNanos() / 1000000);
+}
+
+u32 GetMicros()
+{
+	return (u32)(GetNanos() / 1000);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "platform.h"
+
+// Makes the clock stand still except when advanced with AdvanceClock, so
+// that a replay sees the same times as the trace it replays.
+void UseVirtualClock();
+void AdvanceClock(u32 micros);
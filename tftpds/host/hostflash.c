@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include "platform.h"
+#include "hostflash.h"
+
+// Emulates a Turbo FA 256M: two Intel 28F128J3 chips, interleaved so that
+// the first has the 16 bit words at addresses 0, 4, 8... and the second those
+// at 2, 6, 10... cartlib drives it through WriteFlash and ReadFlash. Each
+// access takes FLASH_ACCESS_NS of emulated time, and erasing and programming
+// keep the chips busy for as long as the datasheet says they typically do.
+// An erase can be suspended to read and program other blocks, and the block
+// only reads as erased once the erase has finished.
+// Everything else reads the cart at CART_BASE directly, as it does on the DS.
+// That only works while both chips are in read array mode, so the view at
+// CART_BASE is made unreadable whenever they aren't, and reading it then stops
+// the program. So does reading the block of a suspended erase. The view is
+// only made readable again when it is read, a block at a time, as changing
+// all of it takes long, and the chips leave read array mode for every write.
+// The chips keep their words in a second mapping of the same memory.
+// With pacing on, the emulated time also passes with the real time, made
+// faster or not, so that the flash gets on while nothing accesses it.
+
+#define FLASH_SIZE 0x2000000
+#define FLASH_CHIPS 2
+#define FLASH_BLOCK_WORDS 0x10000  // 128 kb per chip
+#define FLASH_BLOCK_SIZE (FLASH_BLOCK_WORDS * FLASH_CHIPS * 2)
+#define FLASH_BLOCKS (FLASH_SIZE / FLASH_BLOCK_SIZE)
+#define FLASH_BUFFER_WORDS 16
+#define FLASH_SRAM_SIZE 0x40000
+
+#define FLASH_ACCESS_NS 300ULL
+#define FLASH_ERASE_NS 1000000000ULL
+#define FLASH_PROGRAM_NS 218000ULL
+#define FLASH_SUSPEND_NS 20000ULL
+
+#define FLASH_MANUFACTURER 0x89
+#define FLASH_DEVICE 0x18
+
+#define FLASH_STATUS_READY 0x80
+#define FLASH_STATUS_ERASE_SUSPENDED 0x40
+#define FLASH_STATUS_ERASE_ERROR 0x20
+#define FLASH_STATUS_PROGRAM_ERROR 0x10
+
+enum ChipMode
+{
+	CHIPMODE_ARRAY,
+	CHIPMODE_STATUS,
+	CHIPMODE_ID,
+	CHIPMODE_ERASE_SETUP,
+	CHIPMODE_BUFFER_COUNT,
+	CHIPMODE_BUFFER_DATA,
+	CHIPMODE_BUFFER_CONFIRM
+};
+
+struct Chip
+{
+	enum ChipMode mode;
+	u8 status;
+	u64 busyUntil;
+	int erasing;
+	u32 eraseFirst; // word of the block being erased
+	u64 eraseLeft; // of a suspended erase
+	u32 bufferStart;
+	int bufferCount;
+	int bufferFill;
+	u16 buffer[FLASH_BUFFER_WORDS];
+};
+
+static struct Chip chips[FLASH_CHIPS];
+static u16* words; // both chips, interleaved like at CART_BASE
+static int viewBusy = 0;
+static u32 viewSuspended[FLASH_CHIPS];
+static u8 viewOpen[FLASH_BLOCKS]; // which blocks are readable
+static int viewOpenCount = 0;
+static int viewLock = 0; // the arm7 thread changes the chips too
+static u64 now = 0;
+static int pacing = 0; // how many times faster than real time
+static struct timespec start;
+
+static void* MapAt(u8* address, int size, int protection, int fd)
+{
+	void* memory = mmap(
+		address,
+		size,
+		protection,
+		(fd == -1 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED) | (address != NULL ? MAP_FIXED_NOREPLACE : 0),
+		fd,
+		0);
+	if(memory == MAP_FAILED || (address != NULL && memory != address))
+	{
+		fprintf(stderr, "Cannot map memory at %p\n", address);
+		exit(1);
+	}
+	return memory;
+}
+
+static void LockView()
+{
+	while(__sync_lock_test_and_set(&viewLock, 1))
+	{
+	}
+}
+
+static void UnlockView()
+{
+	__sync_lock_release(&viewLock);
+}
+
+// Makes the block at address readable, if the chips are in read array mode.
+static int OpenView(u8* address)
+{
+	u32 block = (u32)(address - CART_BASE) / FLASH_BLOCK_SIZE;
+	int i;
+	if(viewOpen[block] || viewBusy)
+	{
+		return 0;
+	}
+	for(i = 0; i < FLASH_CHIPS; i++)
+	{
+		if(viewSuspended[i] == block + 1)
+		{
+			return 0;
+		}
+	}
+
+	mprotect(CART_BASE + block * FLASH_BLOCK_SIZE, FLASH_BLOCK_SIZE, PROT_READ);
+	viewOpen[block] = 1;
+	viewOpenCount++;
+	return 1;
+}
+
+static void CloseView()
+{
+	u32 block;
+	for(block = 0; block < FLASH_BLOCKS && viewOpenCount > 0; block++)
+	{
+		if(viewOpen[block])
+		{
+			mprotect(CART_BASE + block * FLASH_BLOCK_SIZE, FLASH_BLOCK_SIZE, PROT_NONE);
+			viewOpen[block] = 0;
+			viewOpenCount--;
+		}
+	}
+}
+
+static void OnFault(int signal, siginfo_t* info, void* context)
+{
+	u8* address = (u8*)info->si_addr;
+	if(address >= CART_BASE && address < CART_BASE + FLASH_SIZE)
+	{
+		LockView();
+		int opened = OpenView(address);
+		UnlockView();
+		if(opened)
+		{
+			return;
+		}
+		fprintf(stderr, "Cart accessed at %p while the flash is busy, or written to\n", address);
+		abort();
+	}
+
+	// anything else crashes as usual once the access is retried
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = SIG_DFL;
+	sigaction(SIGSEGV, &action, NULL);
+}
+
+void MapCart(const char* image)
+{
+	int fd;
+	if(image == NULL)
+	{
+		fd = memfd_create("cart", 0);
+		if(fd == -1 || ftruncate(fd, FLASH_SIZE) != 0)
+		{
+			perror("memfd_create");
+			exit(1);
+		}
+		words = (u16*)MapAt(NULL, FLASH_SIZE, PROT_READ | PROT_WRITE, fd);
+		memset(words, 0xff, FLASH_SIZE);
+	}
+	else
+	{
+		fd = open(image, O_RDWR | O_CREAT, 0644);
+		if(fd == -1)
+		{
+			perror(image);
+			exit(1);
+		}
+
+		// a new image is as erased as a new cart
+		off_t size = lseek(fd, 0, SEEK_END);
+		if(size < FLASH_SIZE)
+		{
+			u8 erased[0x1000];
+			memset(erased, 0xff, sizeof(erased));
+			while(size < FLASH_SIZE)
+			{
+				int count = FLASH_SIZE - size < (off_t)sizeof(erased) ? FLASH_SIZE - size : (int)sizeof(erased);
+				if(write(fd, erased, count) != count)
+				{
+					perror(image);
+					exit(1);
+				}
+				size += count;
+			}
+		}
+		words = (u16*)MapAt(NULL, FLASH_SIZE, PROT_READ | PROT_WRITE, fd);
+	}
+	MapAt(CART_BASE, FLASH_SIZE, PROT_NONE, fd);
+	close(fd);
+
+	MapAt(SRAM_BASE, FLASH_SRAM_SIZE, PROT_READ | PROT_WRITE, -1);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = OnFault;
+	action.sa_flags = SA_SIGINFO;
+	sigaction(SIGSEGV, &action, NULL);
+
+	int i;
+	for(i = 0; i < FLASH_CHIPS; i++)
+	{
+		chips[i].mode = CHIPMODE_ARRAY;
+		chips[i].status = FLASH_STATUS_READY;
+		chips[i].busyUntil = 0;
+		chips[i].erasing = 0;
+		chips[i].eraseLeft = 0;
+		viewSuspended[i] = 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+void SetFlashPacing(int speed)
+{
+	pacing = speed;
+}
+
+static u64 GetRealTime()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (u64)(t.tv_sec - start.tv_sec) * 1000000000ULL + t.tv_nsec - start.tv_nsec;
+}
+
+// Lets the emulated time pass. With pacing it keeps up with the real time,
+// and waits for it when it is ahead.
+static void Tick()
+{
+	now += FLASH_ACCESS_NS;
+	if(pacing)
+	{
+		u64 real = GetRealTime() * pacing;
+		if(now < real)
+		{
+			now = real;
+		}
+		while(GetRealTime() * pacing < now)
+		{
+		}
+	}
+}
+
+static u16* WordAt(u32 addr)
+{
+	return &words[((addr - ADDRESS(CART_BASE)) & (FLASH_SIZE - 1)) >> 1];
+}
+
+static int ChipAt(u32 addr)
+{
+	return (addr >> 1) & 1;
+}
+
+// the word number within the chip
+static u32 ChipWord(u32 addr)
+{
+	return ((addr - ADDRESS(CART_BASE)) & (FLASH_SIZE - 1)) >> 2;
+}
+
+static int IsBusy(struct Chip* chip)
+{
+	return now < chip->busyUntil;
+}
+
+// Makes the view unreadable when what the chips show at CART_BASE changes,
+// see above.
+static void UpdateView()
+{
+	int busy = 0;
+	int i;
+	for(i = 0; i < FLASH_CHIPS; i++)
+	{
+		if(chips[i].mode != CHIPMODE_ARRAY)
+		{
+			busy = 1;
+		}
+	}
+
+	int changed = busy != viewBusy;
+	for(i = 0; i < FLASH_CHIPS; i++)
+	{
+		// one past the suspended block, so that 0 is none
+		u32 suspended = chips[i].eraseLeft != 0 ? chips[i].eraseFirst / FLASH_BLOCK_WORDS + 1 : 0;
+		if(suspended != viewSuspended[i])
+		{
+			viewSuspended[i] = suspended;
+			changed = 1;
+		}
+	}
+	viewBusy = busy;
+	if(changed)
+	{
+		CloseView();
+	}
+}
+
+static void Erase(int chipIndex, u32 addr)
+{
+	chips[chipIndex].eraseFirst = ChipWord(addr) & ~(FLASH_BLOCK_WORDS - 1);
+	chips[chipIndex].busyUntil = now + FLASH_ERASE_NS;
+	chips[chipIndex].erasing = 1;
+}
+
+// Finishes an erase whose time is up.
+static void Settle(int chipIndex)
+{
+	struct Chip* chip = &chips[chipIndex];
+	if(!chip->erasing || IsBusy(chip))
+	{
+		return;
+	}
+
+	u32 i;
+	for(i = 0; i < FLASH_BLOCK_WORDS; i++)
+	{
+		words[(chip->eraseFirst + i) * FLASH_CHIPS + chipIndex] = 0xffff;
+	}
+	chip->erasing = 0;
+}
+
+static void SuspendErase(struct Chip* chip)
+{
+	chip->eraseLeft = chip->busyUntil - now;
+	chip->busyUntil = now + FLASH_SUSPEND_NS;
+	chip->erasing = 0;
+	chip->status |= FLASH_STATUS_ERASE_SUSPENDED;
+	chip->mode = CHIPMODE_STATUS;
+}
+
+static void ResumeErase(struct Chip* chip)
+{
+	chip->busyUntil = now + chip->eraseLeft;
+	chip->eraseLeft = 0;
+	chip->erasing = 1;
+	chip->status &= ~FLASH_STATUS_ERASE_SUSPENDED;
+	chip->mode = CHIPMODE_STATUS;
+}
+
+static void Program(int chipIndex)
+{
+	struct Chip* chip = &chips[chipIndex];
+	int i;
+	for(i = 0; i < chip->bufferFill; i++)
+	{
+		// programming can only clear bits
+		words[(chip->bufferStart + i) * FLASH_CHIPS + chipIndex] &= chip->buffer[i];
+	}
+	chip->busyUntil = now + FLASH_PROGRAM_NS;
+}
+
+static void Command(u32 addr, u16 data)
+{
+	int chipIndex = ChipAt(addr);
+	struct Chip* chip = &chips[chipIndex];
+	u8 command = data & 0xff;
+	if(IsBusy(chip))
+	{
+		// the chip only answers with its status while it is busy, and an
+		// erase can be suspended
+		if(command == 0xb0 && chip->erasing)
+		{
+			SuspendErase(chip);
+		}
+		return;
+	}
+
+	switch(chip->mode)
+	{
+	case CHIPMODE_ERASE_SETUP:
+		chip->mode = CHIPMODE_STATUS;
+		if(command == 0xd0)
+		{
+			Erase(chipIndex, addr);
+		}
+		else
+		{
+			chip->status |= FLASH_STATUS_ERASE_ERROR | FLASH_STATUS_PROGRAM_ERROR;
+		}
+		return;
+
+	case CHIPMODE_BUFFER_COUNT:
+		chip->bufferCount = (data & 0xff) + 1;
+		chip->bufferStart = ChipWord(addr);
+		chip->bufferFill = 0;
+		if(chip->bufferCount > FLASH_BUFFER_WORDS)
+		{
+			chip->status |= FLASH_STATUS_ERASE_ERROR | FLASH_STATUS_PROGRAM_ERROR;
+			chip->mode = CHIPMODE_STATUS;
+		}
+		else
+		{
+			chip->mode = CHIPMODE_BUFFER_DATA;
+		}
+		return;
+
+	case CHIPMODE_BUFFER_DATA:
+		chip->buffer[chip->bufferFill++] = data;
+		if(chip->bufferFill == chip->bufferCount)
+		{
+			chip->mode = CHIPMODE_BUFFER_CONFIRM;
+		}
+		return;
+
+	case CHIPMODE_BUFFER_CONFIRM:
+		chip->mode = CHIPMODE_STATUS;
+		if(command == 0xd0)
+		{
+			Program(chipIndex);
+		}
+		else
+		{
+			chip->status |= FLASH_STATUS_ERASE_ERROR | FLASH_STATUS_PROGRAM_ERROR;
+		}
+		return;
+
+	default:
+		break;
+	}
+
+	switch(command)
+	{
+	case 0xff:
+		chip->mode = CHIPMODE_ARRAY;
+		break;
+	case 0x70:
+		chip->mode = CHIPMODE_STATUS;
+		break;
+	case 0x50:
+		chip->status = FLASH_STATUS_READY | (chip->status & FLASH_STATUS_ERASE_SUSPENDED);
+		break;
+	case 0xd0:
+		if(chip->eraseLeft != 0)
+		{
+			ResumeErase(chip);
+		}
+		break;
+	case 0x90:
+		chip->mode = CHIPMODE_ID;
+		break;
+	case 0x20:
+		chip->mode = CHIPMODE_ERASE_SETUP;
+		break;
+	case 0xe8:
+		// the write buffer is always available, which the chip tells
+		// through bit 7 of what is read next
+		chip->mode = CHIPMODE_BUFFER_COUNT;
+		break;
+	default:
+		// not a command, like the writes that switch the visoly modes
+		break;
+	}
+}
+
+void WriteFlash(u32 addr, u16 data)
+{
+	Tick();
+	Settle(ChipAt(addr));
+	LockView();
+	Command(addr, data);
+	UpdateView();
+	UnlockView();
+}
+
+u16 ReadFlash(u32 addr)
+{
+	Tick();
+	Settle(ChipAt(addr));
+
+	struct Chip* chip = &chips[ChipAt(addr)];
+	if(IsBusy(chip))
+	{
+		return chip->status & ~FLASH_STATUS_READY;
+	}
+
+	switch(chip->mode)
+	{
+	case CHIPMODE_ARRAY:
+		return *WordAt(addr);
+	case CHIPMODE_ID:
+		switch(ChipWord(addr))
+		{
+		case 0: return FLASH_MANUFACTURER;
+		case 1: return FLASH_DEVICE;
+		default: return 0;
+		}
+	case CHIPMODE_BUFFER_COUNT:
+		return FLASH_STATUS_READY;
+	default:
+		return chip->status;
+	}
+}
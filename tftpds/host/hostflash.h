@@ -0,0 +1,22 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maps the emulated flash cart at CART_BASE and the sram at SRAM_BASE. The
+// cart is kept in the given image file, or only in memory if it is NULL.
+// Must be called before anything touches them.
+void MapCart(const char* image);
+
+// Makes erasing and programming take as long as on a real cart, divided by
+// speed, also while the cart isn't accessed. With 0, time only passes as
+// it is accessed, which is what replays need to be repeatable.
+void SetFlashPacing(int speed);
+
+// how much faster than a real cart -f makes the flash
+#define FLASH_FAST_PACING 1000
+
+#ifdef __cplusplus
+}
+#endif
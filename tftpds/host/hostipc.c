@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "platform.h"
+#include "flashring.h"
+#include "hostipc.h"
+#include "../arm7/source/flashring7.h"
+
+// The IPC FIFO between the two cpus, which holds 16 words each way. The
+// thread started by StartArm7 is the ARM7 end, and everything else the
+// ARM9 end.
+#define FIFO_SIZE 16
+
+struct Fifo
+{
+	u32 words[FIFO_SIZE];
+	int first;
+	int count;
+};
+
+vu16 hostExmemcnt = 0;
+
+static struct Fifo fifos[2]; // to the ARM7, and to the ARM9
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int isArm7 = 0;
+
+int FlashRingSend(u32 message)
+{
+	struct Fifo* fifo = &fifos[isArm7];
+	pthread_mutex_lock(&mutex);
+	int sent = fifo->count < FIFO_SIZE;
+	if(sent)
+	{
+		fifo->words[(fifo->first + fifo->count) % FIFO_SIZE] = message;
+		fifo->count++;
+	}
+	pthread_mutex_unlock(&mutex);
+	return sent;
+}
+
+int FlashRingReceive(u32* message)
+{
+	struct Fifo* fifo = &fifos[!isArm7];
+	pthread_mutex_lock(&mutex);
+	int received = fifo->count > 0;
+	if(received)
+	{
+		*message = fifo->words[fifo->first];
+		fifo->first = (fifo->first + 1) % FIFO_SIZE;
+		fifo->count--;
+	}
+	pthread_mutex_unlock(&mutex);
+	if(!received)
+	{
+		// the ARM9 waits for the ARM7 by polling, which on a pc with one
+		// core would keep the thread from running
+		sched_yield();
+	}
+	return received;
+}
+
+static void* Arm7Main(void* arg)
+{
+	isArm7 = 1;
+	while(1)
+	{
+		if(!FlashRingStep())
+		{
+			usleep(100);
+		}
+	}
+	return NULL;
+}
+
+void StartArm7(void)
+{
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, Arm7Main, NULL) != 0)
+	{
+		fprintf(stderr, "Cannot start the ARM7 thread\n");
+		exit(1);
+	}
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starts a thread that does what the ARM7 does with the flash cart, and
+// takes the ARM7 end of the IPC FIFO. See flashring.h.
+void StartArm7(void);
+
+#ifdef __cplusplus
+}
+#endif
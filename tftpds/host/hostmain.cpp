@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include "tftpserver.h"
+#include "clock.h"
+#include "platform.h"
+#include "hostflash.h"
+#include "hostipc.h"
+#include "flashengine.h"
+#include "flashcartfile.h"
+#include "packettrace.h"
+
+// The server core as a Linux program, with an emulated flash cart, for
+// measuring the protocol and storage paths on a workstation.
+int main(int argc, char** argv)
+{
+	int port = 6969;
+	const char* image = NULL;
+	int pacing = 1;
+	bool trace = false;
+	bool arm7 = false;
+	bool delta = false;
+	int opt;
+	while((opt = getopt(argc, argv, "p:c:ft7d")) != -1)
+	{
+		switch(opt)
+		{
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			image = optarg;
+			break;
+		case 'f':
+			pacing = FLASH_FAST_PACING;
+			break;
+		case 't':
+			trace = true;
+			break;
+		case '7':
+			arm7 = true;
+			break;
+		case 'd':
+			delta = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-c cart image] [-f] [-7] [-d] [-t]\n", argv[0]);
+			fprintf(stderr, "  -f  don't make the flash as slow as on a real cart\n");
+			fprintf(stderr, "  -7  program the flash from a thread, like the ARM7 does\n");
+			fprintf(stderr, "  -d  skip unchanged blocks, like pressing A\n");
+			fprintf(stderr, "  -t  trace packets, to be retrieved from /trace/\n");
+			return 1;
+		}
+	}
+
+	// buffers handed to cartlib must be in the lower 4 GB, which the heap
+	// is as long as malloc doesn't use mmap
+	mallopt(M_MMAP_MAX, 0);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	MapCart(image);
+	SetFlashPacing(pacing);
+	StartClock();
+	if(arm7)
+	{
+		StartArm7();
+		FlashEngine::UseArm7(true);
+	}
+	FlashCartFile::UseDelta(delta);
+	PacketTrace::Enable(trace);
+
+	try
+	{
+		TftpServer server(port);
+		while(true)
+		{
+			if(!server.Step())
+			{
+				usleep(100);
+			}
+		}
+	}
+	catch(const char* exception)
+	{
+		printf("\n*** Exception\n%s\n", exception);
+		return 1;
+	}
+}
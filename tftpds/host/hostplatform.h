@@ -0,0 +1,25 @@
+#pragma once
+
+// The parts of libnds that the server core uses, for building it as a Linux
+// program. See platform.h.
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef volatile u8 vu8;
+typedef volatile u16 vu16;
+typedef volatile u32 vu32;
+
+#define BIT(n) (1 << (n))
+
+// The ARM9 hands the GBA slot to the ARM7 with bit 7. The host build keeps
+// its ARM7 in a thread, see hostipc.h, and shares memory with it directly.
+extern vu16 hostExmemcnt;
+#define REG_EXMEMCNT hostExmemcnt
+#define DC_FlushRange(address, length) __sync_synchronize()
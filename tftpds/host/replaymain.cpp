@@ -0,0 +1,445 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+#include "tftpserver.h"
+#include "packettrace.h"
+#include "statsfile.h"
+#include "clock.h"
+#include "platform.h"
+#include "hostclock.h"
+#include "hostflash.h"
+
+#define REPLAY_MAX_CLIENTS 32
+#define REPLAY_MAX_PACKETSIZE 2048
+#define REPLAY_STEP 1000
+// how long to let the server finish after the last record
+#define REPLAY_DRAIN_TIME 60000000
+
+// The end of a client in the trace, replayed from a socket of its own.
+struct Client
+{
+	u32 address;
+	u16 port;
+	int sock;
+	int sessionPort;
+	u64 lastUsed;
+};
+
+// Packets sent by the server, by opcode.
+struct Counts
+{
+	unsigned int ops[8];
+	unsigned int total;
+};
+
+static const char* opNames[8] = { "?", "RRQ", "WRQ", "DATA", "ACK", "ERROR", "OACK", "?" };
+
+static Client clients[REPLAY_MAX_CLIENTS];
+static int clientCount = 0;
+static Counts traced;
+static Counts replayed;
+static u64 now = 0;
+static int serverPort = 7171;
+
+static void CountPacket(Counts* counts, const u8* packet, int length)
+{
+	int op = (length >= 2) ? ntohs(*(const u16*)packet) : 0;
+	counts->ops[(op >= 0 && op < 8) ? op : 0]++;
+	counts->total++;
+}
+
+// Loads a whole trace, and returns the records one after another.
+static u8* LoadTrace(const char* filename, int* length)
+{
+	FILE* f = fopen(filename, "rb");
+	if(f == NULL)
+	{
+		perror(filename);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	int size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	u8* data = (u8*)malloc(size);
+	if(fread(data, 1, size, f) != (size_t)size)
+	{
+		perror(filename);
+		exit(1);
+	}
+	fclose(f);
+
+	const PacketTraceHeader* header = (const PacketTraceHeader*)data;
+	if(size < (int)sizeof(*header) ||
+		memcmp(header->magic, PACKETTRACE_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != PACKETTRACE_VERSION)
+	{
+		fprintf(stderr, "%s: not a packet trace\n", filename);
+		exit(1);
+	}
+
+	*length = size - header->headerSize;
+	return data + header->headerSize;
+}
+
+// Returns the next record, or NULL at the end of the trace.
+static const PacketTraceRecord* NextRecord(const u8* trace, int length, int* position)
+{
+	if(*position + (int)sizeof(PacketTraceRecord) > length)
+	{
+		return NULL;
+	}
+	const PacketTraceRecord* record = (const PacketTraceRecord*)(trace + *position);
+	if(record->size < sizeof(PacketTraceRecord) + record->captured ||
+		*position + record->size > length)
+	{
+		fprintf(stderr, "Broken record at %i\n", *position);
+		return NULL;
+	}
+	*position += record->size;
+	return record;
+}
+
+static void Describe(const PacketTraceRecord* record, char* text)
+{
+	const u8* packet = (const u8*)(record + 1);
+	int op = (record->captured >= 2) ? ntohs(*(const u16*)packet) : 0;
+	int value = (record->captured >= 4) ? ntohs(*(const u16*)(packet + 2)) : 0;
+	const char* name = opNames[(op >= 0 && op < 8) ? op : 0];
+	switch(op)
+	{
+	case TFTP_MSG_DATA:
+		sprintf(text, "%s %i (%i bytes)", name, value, record->length - TFTP_HEADERSIZE);
+		break;
+	case TFTP_MSG_ACK:
+		sprintf(text, "%s %i", name, value);
+		break;
+	case TFTP_MSG_ERROR:
+		sprintf(text, "%s %i %.*s", name, value, record->captured - 4, packet + 4);
+		break;
+	case TFTP_MSG_RRQ:
+	case TFTP_MSG_WRQ:
+	case TFTP_MSG_OACK:
+		{
+			// the strings, separated by spaces
+			text += sprintf(text, "%s", name);
+			for(int i = 2; i < record->captured; )
+			{
+				const char* string = (const char*)packet + i;
+				int count = strnlen(string, record->captured - i);
+				text += sprintf(text, " %.*s", count, string);
+				i += count + 1;
+			}
+		}
+		break;
+	default:
+		sprintf(text, "%s (%i bytes)", name, record->length);
+		break;
+	}
+}
+
+// Writes a trace as text, a line per packet.
+static void Dump(const u8* trace, int length)
+{
+	int position = 0;
+	const PacketTraceRecord* record;
+	const PacketTraceRecord* first = NULL;
+	u64 time = 0;
+	u32 last = 0;
+	while((record = NextRecord(trace, length, &position)) != NULL)
+	{
+		if(first == NULL)
+		{
+			first = record;
+			last = record->time;
+		}
+		time += (u32)(record->time - last);
+		last = record->time;
+
+		struct in_addr address;
+		address.s_addr = record->address;
+		char text[REPLAY_MAX_PACKETSIZE];
+		Describe(record, text);
+		bool outbound = record->flags & PACKETTRACE_OUTBOUND;
+		printf("%11.6f %-3s %15s:%-5u %s %5u%s  %s\n",
+			time / 1000000.0,
+			outbound ? "out" : "in",
+			inet_ntoa(address), ntohs(record->port),
+			outbound ? "<-" : "->",
+			record->localPort,
+			(record->flags & PACKETTRACE_LISTENER) ? "*" : " ",
+			text);
+	}
+}
+
+static Client* GetClient(u32 address, u16 port)
+{
+	Client* oldest = NULL;
+	for(int i = 0; i < clientCount; i++)
+	{
+		if(clients[i].address == address && clients[i].port == port)
+		{
+			clients[i].lastUsed = now;
+			return &clients[i];
+		}
+		if(oldest == NULL || clients[i].lastUsed < oldest->lastUsed)
+		{
+			oldest = &clients[i];
+		}
+	}
+
+	Client* client;
+	if(clientCount < REPLAY_MAX_CLIENTS)
+	{
+		client = &clients[clientCount++];
+	}
+	else
+	{
+		client = oldest;
+		close(client->sock);
+	}
+
+	client->address = address;
+	client->port = port;
+	client->sessionPort = 0;
+	client->lastUsed = now;
+	client->sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(client->sock == -1) { THROW_ERRNO("socket"); }
+	int i = 1;
+	ioctl(client->sock, FIONBIO, &i);
+	return client;
+}
+
+// Takes what the server sent to the clients, and learns which port each
+// transfer uses.
+static void Drain()
+{
+	for(int i = 0; i < clientCount; i++)
+	{
+		u8 packet[REPLAY_MAX_PACKETSIZE];
+		struct sockaddr_in from;
+		socklen_t fromlen = sizeof(from);
+		int count;
+		while((count = recvfrom(clients[i].sock, packet, sizeof(packet), 0, (struct sockaddr*)&from, &fromlen)) != -1)
+		{
+			fromlen = sizeof(from);
+			CountPacket(&replayed, packet, count);
+			if(ntohs(from.sin_port) != serverPort)
+			{
+				clients[i].sessionPort = ntohs(from.sin_port);
+			}
+		}
+	}
+}
+
+// Runs the server until the clock reaches time, a millisecond at a time
+// so that timeouts happen when they are due.
+static void RunUntil(TftpServer& server, u64 time)
+{
+	while(true)
+	{
+		while(server.Step())
+		{
+			Drain();
+		}
+		Drain();
+		if(now >= time)
+		{
+			return;
+		}
+
+		u64 step = server.IsBusy() ? REPLAY_STEP : time - now;
+		if(step > time - now)
+		{
+			step = time - now;
+		}
+		AdvanceClock(step);
+		now += step;
+	}
+}
+
+// The counters of /stats/, without the histograms.
+static void PrintCounters()
+{
+	static char text[0x10000];
+	StatsFile file("all", false);
+	int length = 0;
+	int count;
+	while((count = file.Read(text + length, sizeof(text) - 1 - length)) > 0)
+	{
+		length += count;
+	}
+	file.Close();
+	text[length] = '\0';
+
+	for(char* line = strtok(text, "\n"); line != NULL; line = strtok(NULL, "\n"))
+	{
+		if(strchr(line, '{') == NULL)
+		{
+			printf("  %s\n", line);
+		}
+	}
+}
+
+static double GetCpuMillis()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+	return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+// Sends the packets the clients sent in a trace to the server, at the same
+// times as in the trace, and compares what the server answers with what it
+// answered then. The flash is emulated without the time it takes, and the
+// data of DATA messages, which isn't in the trace, is zeros.
+int main(int argc, char** argv)
+{
+	bool dump = false;
+	const char* output = NULL;
+	int opt;
+	while((opt = getopt(argc, argv, "p:do:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'p':
+			serverPort = atoi(optarg);
+			break;
+		case 'd':
+			dump = true;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if(optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s [-p port] [-d] [-o trace] trace\n", argv[0]);
+		fprintf(stderr, "  -d  write the trace as text instead of replaying it\n");
+		fprintf(stderr, "  -o  trace the replay to a file\n");
+		return 1;
+	}
+
+	int length;
+	const u8* trace = LoadTrace(argv[optind], &length);
+	if(dump)
+	{
+		Dump(trace, length);
+		return 0;
+	}
+
+	mallopt(M_MMAP_MAX, 0);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	MapCart(NULL);
+	SetFlashPacing(0);
+	UseVirtualClock();
+	PacketTrace::Enable(output != NULL);
+
+	unsigned int inbound = 0;
+	unsigned int undelivered = 0;
+	double cpuStart = GetCpuMillis();
+	try
+	{
+		TftpServer server(serverPort);
+
+		int position = 0;
+		const PacketTraceRecord* record;
+		u64 time = 0;
+		u32 last = 0;
+		bool first = true;
+		while((record = NextRecord(trace, length, &position)) != NULL)
+		{
+			if(first)
+			{
+				last = record->time;
+				first = false;
+			}
+			time += (u32)(record->time - last);
+			last = record->time;
+			RunUntil(server, time);
+
+			const u8* captured = (const u8*)(record + 1);
+			if(record->flags & PACKETTRACE_OUTBOUND)
+			{
+				CountPacket(&traced, captured, record->captured);
+				continue;
+			}
+
+			inbound++;
+			Client* client = GetClient(record->address, record->port);
+			int port = client->sessionPort;
+			if(record->flags & PACKETTRACE_LISTENER)
+			{
+				// a new transfer, which will get a port of its own
+				port = serverPort;
+				client->sessionPort = 0;
+			}
+			if(port == 0 || record->length > REPLAY_MAX_PACKETSIZE)
+			{
+				undelivered++;
+				continue;
+			}
+
+			u8 packet[REPLAY_MAX_PACKETSIZE];
+			memcpy(packet, captured, record->captured);
+			memset(packet + record->captured, 0, record->length - record->captured);
+
+			struct sockaddr_in to;
+			memset(&to, 0, sizeof(to));
+			to.sin_family = AF_INET;
+			to.sin_port = htons(port);
+			to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			if(sendto(client->sock, packet, record->length, 0, (struct sockaddr*)&to, sizeof(to)) == -1)
+			{
+				THROW_ERRNO("sendto");
+			}
+		}
+
+		// let the transfers that are still going time out
+		u64 end = time + REPLAY_DRAIN_TIME;
+		do
+		{
+			RunUntil(server, now + REPLAY_STEP);
+		}
+		while(server.IsBusy() && now < end);
+	}
+	catch(const char* exception)
+	{
+		printf("\n*** Exception\n%s\n", exception);
+		return 1;
+	}
+	double cpu = GetCpuMillis() - cpuStart;
+
+	printf("\nReplayed %u packets from clients over %.3f s in %.1f ms of cpu time\n",
+		inbound, now / 1000000.0, cpu);
+	if(undelivered > 0)
+	{
+		printf("%u packets had no transfer to go to\n", undelivered);
+	}
+	printf("Sent by the server:  trace  replay\n");
+	for(int op = 1; op < 8; op++)
+	{
+		if(traced.ops[op] != 0 || replayed.ops[op] != 0)
+		{
+			printf("  %-16s %7u %7u\n", opNames[op], traced.ops[op], replayed.ops[op]);
+		}
+	}
+	printf("  %-16s %7u %7u\n", "total", traced.total, replayed.total);
+	printf("Counters after the replay:\n");
+	PrintCounters();
+
+	if(output != NULL && !PacketTrace::Save(output))
+	{
+		perror(output);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+#include "tftpclient.h"
+#include "clock.h"
+
+#define CLIENT_MAX_TIMEOUTS 50
+
+TftpClient::TftpClient(const Impairment& impairment, unsigned int seed, int timeout)
+:	timeout(timeout),
+	state(CLIENTSTATE_IDLE),
+	sending(false),
+	data(NULL),
+	length(0),
+	blocksize(TFTP_DEFAULT_BLOCKSIZE),
+	windowsize(TFTP_DEFAULT_WINDOWSIZE),
+	blockCount(0),
+	requestLength(0),
+	deadline(0),
+	timeoutsInRow(0),
+	retransmits(0),
+	timeouts(0),
+	error(NULL),
+	firstUnackedBlock(1),
+	lastBlockSent(0),
+	lastReceivedBlock(0),
+	blocksUnacked(0),
+	gapAcked(false)
+{
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(sock == -1) { THROW_ERRNO("socket"); }
+	int i = 1;
+	ioctl(sock, FIONBIO, &i);
+	shim = new UdpShim(sock, impairment, seed);
+}
+
+TftpClient::~TftpClient()
+{
+	delete shim;
+	close(sock);
+}
+
+void TftpClient::Put(int port, const char* filename, const char* source, int size, int block, int window)
+{
+	sending = true;
+	data = (char*)source;
+	length = size;
+	blocksize = block;
+	windowsize = window;
+	Request(port, TFTP_MSG_WRQ, filename, size);
+}
+
+void TftpClient::Get(int port, const char* filename, char* dest, int size, int block, int window)
+{
+	sending = false;
+	data = dest;
+	length = size;
+	blocksize = block;
+	windowsize = window;
+	Request(port, TFTP_MSG_RRQ, filename, 0);
+}
+
+void TftpClient::Request(int port, int op, const char* filename, int tsize)
+{
+	char* ptr = request;
+	*(short*)ptr = htons(op);
+	ptr += 2;
+	ptr += sprintf(ptr, "%s", filename) + 1;
+	ptr += sprintf(ptr, "octet") + 1;
+	ptr += sprintf(ptr, "blksize") + 1;
+	ptr += sprintf(ptr, "%i", blocksize) + 1;
+	ptr += sprintf(ptr, "windowsize") + 1;
+	ptr += sprintf(ptr, "%i", windowsize) + 1;
+	ptr += sprintf(ptr, "tsize") + 1;
+	ptr += sprintf(ptr, "%i", tsize) + 1;
+	requestLength = ptr - request;
+
+	memset(&remote, 0, sizeof(remote));
+	remote.sin_family = AF_INET;
+	remote.sin_port = htons(port);
+	remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	state = CLIENTSTATE_REQUESTING;
+	shim->SendTo(request, requestLength, remote);
+	deadline = GetMillis() + timeout;
+}
+
+bool TftpClient::Step()
+{
+	if(state == CLIENTSTATE_IDLE || state == CLIENTSTATE_FAILED)
+	{
+		return false;
+	}
+
+	struct sockaddr_in from;
+	int count = shim->ReceiveFrom(packet, sizeof(packet), &from);
+	if(count == -1)
+	{
+		if(state != CLIENTSTATE_FINISHED && !CLOCK_BEFORE(GetMillis(), deadline))
+		{
+			HandleTimeout();
+			return true;
+		}
+		return false;
+	}
+
+	if(count < TFTP_HEADERSIZE || (state == CLIENTSTATE_FINISHED && sending))
+	{
+		return true;
+	}
+	if(state == CLIENTSTATE_REQUESTING)
+	{
+		// the server answers from the port of the transfer
+		remote.sin_port = from.sin_port;
+	}
+	else if(from.sin_port != remote.sin_port)
+	{
+		return true;
+	}
+
+	timeoutsInRow = 0;
+	deadline = GetMillis() + timeout;
+	TftpMsgData* msg = (TftpMsgData*)packet;
+	switch(ntohs(msg->op))
+	{
+	case TFTP_MSG_OACK:
+		if(state == CLIENTSTATE_REQUESTING)
+		{
+			HandleOAck();
+		}
+		break;
+	case TFTP_MSG_ACK:
+		if(sending)
+		{
+			HandleAck(ntohs(msg->block));
+		}
+		break;
+	case TFTP_MSG_DATA:
+		if(!sending)
+		{
+			HandleData(ntohs(msg->block), msg->data, count - TFTP_HEADERSIZE);
+		}
+		break;
+	case TFTP_MSG_ERROR:
+		packet[count < (int)sizeof(packet) ? count : sizeof(packet) - 1] = '\0';
+		Fail(strdup(packet + TFTP_HEADERSIZE));
+		break;
+	}
+	return true;
+}
+
+void TftpClient::HandleOAck()
+{
+	// the server may have chosen smaller values
+	const char* ptr = packet + 2;
+	const char* end = packet + sizeof(packet);
+	while(ptr < end && *ptr != '\0')
+	{
+		const char* option = ptr;
+		ptr += strlen(option) + 1;
+		const char* value = ptr;
+		ptr += strlen(value) + 1;
+		if(strcmp(option, "blksize") == 0)
+		{
+			sscanf(value, "%i", &blocksize);
+		}
+		else if(strcmp(option, "windowsize") == 0)
+		{
+			sscanf(value, "%i", &windowsize);
+		}
+		else if(strcmp(option, "tsize") == 0 && !sending)
+		{
+			int size = 0;
+			sscanf(value, "%i", &size);
+			if(size < length)
+			{
+				length = size;
+			}
+		}
+	}
+
+	blockCount = length / blocksize + 1;
+	if(sending)
+	{
+		state = CLIENTSTATE_SENDING;
+		SendWindow();
+	}
+	else
+	{
+		state = CLIENTSTATE_RECEIVING;
+		SendAck(0);
+	}
+}
+
+void TftpClient::HandleAck(unsigned short block)
+{
+	if(state != CLIENTSTATE_SENDING)
+	{
+		return;
+	}
+
+	unsigned short offset = block - (firstUnackedBlock & 0xFFFF);
+	if(offset == 0xFFFF)
+	{
+		// the server missed a block, and tells us the last one it got
+		SendWindow();
+		return;
+	}
+	if((int)offset >= lastBlockSent - firstUnackedBlock + 1)
+	{
+		return;
+	}
+
+	firstUnackedBlock += offset + 1;
+	if(firstUnackedBlock > blockCount)
+	{
+		state = CLIENTSTATE_FINISHED;
+		return;
+	}
+	SendWindow();
+}
+
+void TftpClient::HandleData(unsigned short block, const char* payload, int count)
+{
+	unsigned short expected = lastReceivedBlock + 1;
+	if(state == CLIENTSTATE_FINISHED)
+	{
+		// the server didn't get our last ack
+		if(block == lastReceivedBlock)
+		{
+			SendAck(lastReceivedBlock);
+		}
+		return;
+	}
+
+	if(block != expected)
+	{
+		if((short)(block - expected) > 0 && !gapAcked)
+		{
+			SendAck(lastReceivedBlock);
+			blocksUnacked = 0;
+			gapAcked = true;
+		}
+		return;
+	}
+	gapAcked = false;
+
+	int offset = (expected - 1) * blocksize;
+	int size = count;
+	if(offset + size > length)
+	{
+		size = length - offset;
+	}
+	if(size > 0)
+	{
+		memcpy(data + offset, payload, size);
+	}
+	lastReceivedBlock = block;
+	blocksUnacked++;
+
+	if(count < blocksize)
+	{
+		length = offset + count;
+		SendAck(block);
+		state = CLIENTSTATE_FINISHED;
+	}
+	else if(blocksUnacked == windowsize)
+	{
+		SendAck(block);
+		blocksUnacked = 0;
+	}
+}
+
+void TftpClient::HandleTimeout()
+{
+	timeouts++;
+	timeoutsInRow++;
+	if(timeoutsInRow > CLIENT_MAX_TIMEOUTS)
+	{
+		Fail("Transfer timed out");
+		return;
+	}
+
+	switch(state)
+	{
+	case CLIENTSTATE_REQUESTING:
+		shim->SendTo(request, requestLength, remote);
+		break;
+	case CLIENTSTATE_SENDING:
+		SendWindow();
+		break;
+	case CLIENTSTATE_RECEIVING:
+		SendAck(lastReceivedBlock);
+		blocksUnacked = 0;
+		retransmits++;
+		break;
+	default:
+		break;
+	}
+	deadline = GetMillis() + timeout;
+}
+
+void TftpClient::SendWindow()
+{
+	int last = firstUnackedBlock + windowsize - 1;
+	if(last > blockCount)
+	{
+		last = blockCount;
+	}
+
+	for(int block = firstUnackedBlock; block <= last; block++)
+	{
+		int offset = (block - 1) * blocksize;
+		int size = length - offset < blocksize ? length - offset : blocksize;
+		TftpMsgData* msg = (TftpMsgData*)packet;
+		msg->op = htons(TFTP_MSG_DATA);
+		msg->block = htons(block & 0xFFFF);
+		memcpy(msg->data, data + offset, size);
+		shim->SendTo(packet, TFTP_HEADERSIZE + size, remote);
+		if(block <= lastBlockSent)
+		{
+			retransmits++;
+		}
+	}
+	if(last > lastBlockSent)
+	{
+		lastBlockSent = last;
+	}
+}
+
+bool TftpClient::IsAwaitingLastAck() const
+{
+	return state == CLIENTSTATE_SENDING && lastBlockSent == blockCount;
+}
+
+void TftpClient::SendAck(unsigned short block)
+{
+	TftpMsgAck ack;
+	ack.op = htons(TFTP_MSG_ACK);
+	ack.block = htons(block);
+	shim->SendTo(&ack, sizeof(ack), remote);
+}
+
+void TftpClient::Fail(const char* message)
+{
+	error = message;
+	state = CLIENTSTATE_FAILED;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "tftpprotocol.h"
+#include "udpshim.h"
+
+enum ClientState
+{
+	CLIENTSTATE_IDLE,
+	CLIENTSTATE_REQUESTING,
+	CLIENTSTATE_SENDING,
+	CLIENTSTATE_RECEIVING,
+	CLIENTSTATE_FINISHED,
+	CLIENTSTATE_FAILED
+};
+
+// The client end of a transfer for the benchmark, talking through a UdpShim.
+// It asks for blksize, windowsize and tsize, acknowledges once per window
+// like the server, and resends after a fixed timeout.
+class TftpClient
+{
+public:
+	TftpClient(const Impairment& impairment, unsigned int seed, int timeout);
+	~TftpClient();
+
+	void Put(int port, const char* filename, const char* data, int length, int blocksize, int windowsize);
+	void Get(int port, const char* filename, char* data, int length, int blocksize, int windowsize);
+	// Returns true if anything happened.
+	bool Step();
+
+	bool IsFinished() const { return state == CLIENTSTATE_FINISHED; }
+	bool IsFailed() const { return state == CLIENTSTATE_FAILED; }
+	// true when only the ack of the last block is missing
+	bool IsAwaitingLastAck() const;
+	const char* GetError() const { return error; }
+	int GetLength() const { return length; }
+	unsigned int GetRetransmits() const { return retransmits; }
+	unsigned int GetTimeouts() const { return timeouts; }
+
+private:
+	void Request(int port, int op, const char* filename, int tsize);
+	void HandleOAck();
+	void HandleAck(unsigned short block);
+	void HandleData(unsigned short block, const char* payload, int count);
+	void HandleTimeout();
+	void SendWindow();
+	void SendAck(unsigned short block);
+	void Fail(const char* message);
+
+	int sock;
+	UdpShim* shim;
+	int timeout;
+	struct sockaddr_in remote;
+	ClientState state;
+	bool sending;
+	char* data;
+	int length;
+	int blocksize;
+	int windowsize;
+	int blockCount;
+	char request[TFTP_MAX_REQUESTSIZE];
+	int requestLength;
+	char packet[TFTP_HEADERSIZE + TFTP_MAX_BLOCKSIZE];
+	u32 deadline;
+	int timeoutsInRow;
+	unsigned int retransmits;
+	unsigned int timeouts;
+	const char* error;
+
+	// sending
+	int firstUnackedBlock;
+	int lastBlockSent;
+
+	// receiving
+	unsigned short lastReceivedBlock;
+	int blocksUnacked;
+	bool gapAcked;
+};
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "udpshim.h"
+#include "clock.h"
+
+UdpShim::UdpShim(int sock, const Impairment& impairment, unsigned int seed)
+:	sock(sock),
+	impairment(impairment),
+	random(seed),
+	packets(new Packet[UDPSHIM_MAX_PACKETS]),
+	count(0),
+	sequence(0)
+{
+	held[0] = held[1] = -1;
+}
+
+UdpShim::~UdpShim()
+{
+	delete[] packets;
+}
+
+void UdpShim::SendTo(const void* data, int length, const struct sockaddr_in& to)
+{
+	Impair(false, data, length, to);
+	SendDue();
+}
+
+int UdpShim::ReceiveFrom(void* data, int length, struct sockaddr_in* from)
+{
+	char buffer[UDPSHIM_MAX_PACKETSIZE];
+	struct sockaddr_in address;
+	socklen_t addresslen = sizeof(address);
+	int received;
+	while((received = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr*)&address, &addresslen)) != -1)
+	{
+		Impair(true, buffer, received, address);
+	}
+	SendDue();
+
+	int index = NextDue(true);
+	if(index == -1)
+	{
+		return -1;
+	}
+
+	Packet& packet = packets[index];
+	int copied = packet.length < length ? packet.length : length;
+	memcpy(data, packet.data, copied);
+	*from = packet.address;
+	Remove(index);
+	return copied;
+}
+
+void UdpShim::Impair(bool incoming, const void* data, int length, const struct sockaddr_in& address)
+{
+	if(Chance(impairment.drop))
+	{
+		return;
+	}
+
+	u32 due = GetMillis() + impairment.delay;
+	int direction = incoming ? 1 : 0;
+	int copies = Chance(impairment.duplicate) ? 2 : 1;
+	for(int i = 0; i < copies; i++)
+	{
+		int previous = held[direction];
+		held[direction] = -1;
+		if(!Queue(incoming, data, length, address, due))
+		{
+			continue;
+		}
+
+		if(previous != -1)
+		{
+			// the packet held back goes right after this one
+			packets[previous].due = due;
+			packets[previous].sequence = sequence++;
+		}
+		else if(Chance(impairment.reorder))
+		{
+			held[direction] = count - 1;
+		}
+	}
+}
+
+bool UdpShim::Queue(bool incoming, const void* data, int length, const struct sockaddr_in& address, u32 due)
+{
+	if(count == UDPSHIM_MAX_PACKETS || length > UDPSHIM_MAX_PACKETSIZE)
+	{
+		// like a full queue in a router
+		return false;
+	}
+
+	Packet& packet = packets[count++];
+	packet.incoming = incoming;
+	packet.due = due;
+	packet.sequence = sequence++;
+	packet.address = address;
+	packet.length = length;
+	memcpy(packet.data, data, length);
+	return true;
+}
+
+void UdpShim::SendDue()
+{
+	int index;
+	while((index = NextDue(false)) != -1)
+	{
+		Packet& packet = packets[index];
+		sendto(sock, packet.data, packet.length, 0, (struct sockaddr*)&packet.address, sizeof(packet.address));
+		Remove(index);
+	}
+}
+
+// Returns the packet that is due and was queued first, or -1.
+int UdpShim::NextDue(bool incoming)
+{
+	u32 now = GetMillis();
+	int direction = incoming ? 1 : 0;
+	int next = -1;
+	for(int i = 0; i < count; i++)
+	{
+		Packet& packet = packets[i];
+		if(packet.incoming == incoming &&
+			i != held[direction] &&
+			!CLOCK_BEFORE(now, packet.due) &&
+			(next == -1 || packet.sequence < packets[next].sequence))
+		{
+			next = i;
+		}
+	}
+	return next;
+}
+
+void UdpShim::Remove(int index)
+{
+	count--;
+	if(index != count)
+	{
+		packets[index] = packets[count];
+		for(int i = 0; i < 2; i++)
+		{
+			if(held[i] == count)
+			{
+				held[i] = index;
+			}
+		}
+	}
+}
+
+// A small linear congruential generator, so that runs can be repeated.
+bool UdpShim::Chance(int percent)
+{
+	random = random * 1103515245 + 12345;
+	return (int)((random >> 16) % 100) < percent;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "platform.h"
+
+#define UDPSHIM_MAX_PACKETS 256
+#define UDPSHIM_MAX_PACKETSIZE 2048
+
+// How the network between the benchmark client and the server misbehaves.
+// Probabilities are in percent, and the delay applies in each direction.
+struct Impairment
+{
+	int drop;
+	int duplicate;
+	int reorder;
+	int delay;
+};
+
+// Sits between a socket and its user and impairs the packets in both
+// directions: packets are dropped, duplicated, held back behind the next
+// one, and delayed. Since the server answers from a new port for each
+// transfer, this is done at the client instead of in a proxy.
+class UdpShim
+{
+public:
+	UdpShim(int sock, const Impairment& impairment, unsigned int seed);
+	~UdpShim();
+
+	void SendTo(const void* data, int length, const struct sockaddr_in& to);
+	// Returns -1 if there is nothing to receive yet.
+	int ReceiveFrom(void* data, int length, struct sockaddr_in* from);
+
+private:
+	struct Packet
+	{
+		bool incoming;
+		u32 due;
+		unsigned int sequence;
+		struct sockaddr_in address;
+		int length;
+		char data[UDPSHIM_MAX_PACKETSIZE];
+	};
+
+	void Impair(bool incoming, const void* data, int length, const struct sockaddr_in& address);
+	bool Queue(bool incoming, const void* data, int length, const struct sockaddr_in& address, u32 due);
+	void SendDue();
+	int NextDue(bool incoming);
+	void Remove(int index);
+	bool Chance(int percent);
+
+	int sock;
+	Impairment impairment;
+	unsigned int random;
+	Packet* packets;
+	int count;
+	unsigned int sequence;
+	// a packet held back until the next one in the same direction has gone
+	int held[2];
+};